@@ -0,0 +1,261 @@
+// BENCH SOURCE FILE
+// Paul Passeron
+
+// Benchmarks of the compiler, run by make bench from the root of the repo.
+// Synthetic programs stressing one part of the compiler each are generated
+// at growing scales, then compiled with --time-report=json. The measures of
+// each program are printed as JSON on stdout, keeping the fastest of
+// BENCH_RUNS compilations: the time of the lexer, the parser, the generator
+// and the backend, the end to end time, and the peak memory.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_RUNS 3
+#define BENCH_SCALES 3
+#define REPORT_MAX 4096
+
+static const int scales[BENCH_SCALES] = {1, 2, 4};
+
+static char bench_dir[PATH_MAX];
+// the programs include it through a link to the standard library, as
+// includes are relative to the file including them
+static const char *stdlib_io = "stdlib/io.ul";
+
+static FILE *open_input(const char *name) {
+  char path[PATH_MAX + 64];
+  snprintf(path, sizeof(path), "%s/%s", bench_dir, name);
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    fprintf(stderr, "Could not write %s\n", path);
+    exit(1);
+  }
+  return f;
+}
+
+// A chain of functions each calling the previous one
+static void gen_functions(FILE *f, int scale) {
+  int n = 250 * scale;
+  fprintf(f, "@include \"%s\"\n\n", stdlib_io);
+  fprintf(f, "let f_0(x: i32): i32 => {\n  return x;\n}\n\n");
+  for (int i = 1; i < n; i++) {
+    fprintf(f, "let f_%d(x: i32): i32 => {\n", i);
+    fprintf(f, "  let y: i32 => x + %d;\n", i % 7);
+    fprintf(f, "  if (y > %d) => return f_%d(y - %d);\n", i, i - 1, i % 5);
+    fprintf(f, "  return f_%d(y);\n}\n\n", i - 1);
+  }
+  fprintf(f, "let entry(): void => {\n  print_num(f_%d(1));\n}\n", n - 1);
+}
+
+// Expressions nested in each other
+static void gen_expressions(FILE *f, int scale) {
+  int depth = 100 * scale;
+  const char *ops[] = {"+", "-", "*", "+"};
+  fprintf(f, "@include \"%s\"\n\n", stdlib_io);
+  fprintf(f, "let compute(x: i32): i32 => {\n");
+  for (int e = 0; e < 8; e++) {
+    fprintf(f, "  let e_%d: i32 => ", e);
+    for (int i = 0; i < depth; i++)
+      fprintf(f, "(");
+    fprintf(f, "x");
+    for (int i = 0; i < depth; i++)
+      fprintf(f, " %s %d)", ops[(i + e) % 4], i % 9 + 1);
+    fprintf(f, ";\n  x => e_%d %% 1000;\n", e);
+  }
+  fprintf(f, "  return x;\n}\n\n");
+  fprintf(f, "let entry(): void => {\n  print_num(compute(3));\n}\n");
+}
+
+// Structs with many fields and methods
+static void gen_structs(FILE *f, int scale) {
+  int count = 10 * scale;
+  int fields = 40;
+  fprintf(f, "@include \"%s\"\n\n", stdlib_io);
+  for (int s = 0; s < count; s++) {
+    fprintf(f, "struct s_%d => {\n", s);
+    for (int i = 0; i < fields; i++)
+      fprintf(f, "  m_%d: i32,\n", i);
+    fprintf(f, "  let s_%d(): void => {\n", s);
+    for (int i = 0; i < fields; i++)
+      fprintf(f, "    this.m_%d => %d;\n", i, i + s);
+    fprintf(f, "  },\n  let sum(): i32 => {\n    return this.m_0");
+    for (int i = 1; i < fields; i++)
+      fprintf(f, " + this.m_%d", i);
+    fprintf(f, ";\n  }\n}\n\n");
+  }
+  fprintf(f, "let entry(): void => {\n  let total: i32 => 0;\n");
+  for (int s = 0; s < count; s++)
+    fprintf(f, "  let v_%d: s_%d;\n  total => total + v_%d.sum();\n", s, s, s);
+  fprintf(f, "  print_num(total);\n}\n");
+}
+
+// Long string literals
+static void gen_strings(FILE *f, int scale) {
+  int count = 20 * scale;
+  int length = 1000; // the lexer cuts string literals at 1024 characters
+  fprintf(f, "@include \"%s\"\n\n", stdlib_io);
+  fprintf(f, "let entry(): void => {\n");
+  for (int s = 0; s < count; s++) {
+    fprintf(f, "  print(\"");
+    for (int i = 0; i < length; i++)
+      fputc('a' + (i * 7 + s) % 26, f);
+    fprintf(f, "\");\n");
+  }
+  fprintf(f, "  println(\"\");\n}\n");
+}
+
+// A chain of files each including the next one
+static void gen_includes(FILE *f, int scale) {
+  int depth = 16 * scale;
+  for (int i = 0; i < depth; i++) {
+    char name[64];
+    snprintf(name, sizeof(name), "includes_%d_%d.ul", scale, i);
+    FILE *inc = open_input(name);
+    if (i + 1 < depth)
+      fprintf(inc, "@include \"includes_%d_%d.ul\"\n", scale, i + 1);
+    else
+      fprintf(inc, "@include \"%s\"\n", stdlib_io);
+    fprintf(inc, "\nlet g_%d(x: i32): i32 => {\n", i);
+    if (i + 1 < depth)
+      fprintf(inc, "  return g_%d(x + 1);\n}\n", i + 1);
+    else
+      fprintf(inc, "  return x;\n}\n");
+    fclose(inc);
+  }
+  fprintf(f, "@include \"includes_%d_0.ul\"\n\n", scale);
+  fprintf(f, "let entry(): void => {\n  print_num(g_0(0));\n}\n");
+}
+
+typedef struct bench_t {
+  const char *name;
+  void (*generate)(FILE *f, int scale);
+} bench_t;
+
+static const bench_t benches[] = {
+    {"functions", gen_functions}, {"expressions", gen_expressions},
+    {"structs", gen_structs},     {"strings", gen_strings},
+    {"includes", gen_includes},
+};
+
+typedef struct measure_t {
+  int status;
+  double wall_ms;
+  long max_rss_kib; // of the compiler and the processes it waited for
+  char report[REPORT_MAX];
+} measure_t;
+
+static double now_ms(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+// compiles input, the time report being written to report_path
+static measure_t compile(const char *input, const char *report_path) {
+  measure_t res = {.status = -1};
+  char output[PATH_MAX + 72];
+  snprintf(output, sizeof(output), "%s.out", input);
+  double start = now_ms();
+  pid_t pid = fork();
+  if (pid == 0) {
+    int fd = open(report_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      _exit(127);
+    dup2(fd, STDERR_FILENO);
+    execl("bin/Unilang", "bin/Unilang", input, "-o", output, "-s",
+          "--no-cache", "--time-report=json", (char *)NULL);
+    _exit(127);
+  }
+  int status;
+  struct rusage usage;
+  if (pid < 0 || wait4(pid, &status, 0, &usage) < 0)
+    return res;
+  res.wall_ms = now_ms() - start;
+  res.status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  res.max_rss_kib = usage.ru_maxrss;
+  // the report is the last line written on stderr
+  FILE *f = fopen(report_path, "r");
+  char line[REPORT_MAX];
+  strcpy(res.report, "null");
+  while (f != NULL && fgets(line, sizeof(line), f) != NULL) {
+    if (line[0] == '{') {
+      line[strcspn(line, "\n")] = 0;
+      strcpy(res.report, line);
+    }
+  }
+  if (f != NULL)
+    fclose(f);
+  return res;
+}
+
+static long file_size(const char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <directory of the generated programs>\n",
+            argv[0]);
+    return 1;
+  }
+  if (mkdir(argv[1], 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Could not create %s\n", argv[1]);
+    return 1;
+  }
+  char stdlib[PATH_MAX];
+  char link[PATH_MAX + 16];
+  if (realpath(argv[1], bench_dir) == NULL ||
+      realpath("stdlib", stdlib) == NULL) {
+    fprintf(stderr, "The benchmarks run from the root of the repository\n");
+    return 1;
+  }
+  snprintf(link, sizeof(link), "%s/stdlib", bench_dir);
+  if (symlink(stdlib, link) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Could not link %s to the standard library\n", link);
+    return 1;
+  }
+
+  printf("{\"runs\": %d, \"benchmarks\": [", BENCH_RUNS);
+  bool first = true;
+  for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+    for (int s = 0; s < BENCH_SCALES; s++) {
+      char name[64];
+      snprintf(name, sizeof(name), "%s_%d.ul", benches[b].name, scales[s]);
+      FILE *f = open_input(name);
+      benches[b].generate(f, scales[s]);
+      fclose(f);
+
+      char input[PATH_MAX + 64];
+      char report[PATH_MAX + 72];
+      snprintf(input, sizeof(input), "%s/%s", bench_dir, name);
+      snprintf(report, sizeof(report), "%s.report", input);
+      measure_t best = {0};
+      for (int r = 0; r < BENCH_RUNS; r++) {
+        measure_t m = compile(input, report);
+        if (r == 0 || m.wall_ms < best.wall_ms)
+          best = m;
+      }
+      fprintf(stderr, "%-12s x%-3d %10.1f ms\n", benches[b].name, scales[s],
+              best.wall_ms);
+      printf("%s\n  {\"name\": \"%s\", \"scale\": %d, \"input_bytes\": %ld, "
+             "\"status\": %d, \"wall_ms\": %.3f, \"max_rss_kib\": %ld, "
+             "\"report\": %s}",
+             first ? "" : ",", benches[b].name, scales[s], file_size(input),
+             best.status, best.wall_ms, best.max_rss_kib, best.report);
+      first = false;
+    }
+  }
+  printf("\n]}\n");
+  return 0;
+}
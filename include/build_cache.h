@@ -0,0 +1,27 @@
+// BUILD_CACHE HEADER FILE
+// Paul Passeron
+
+#ifndef BUILD_CACHE_H
+#define BUILD_CACHE_H
+
+#include "str_set.h"
+#include <stdbool.h>
+
+// The least recently used builds are evicted past this many bytes
+#define BUILD_CACHE_MAX_SIZE (256ULL << 20)
+
+// key of the build of input and of the sources it includes, by the current
+// compiler with the given flags
+unsigned long long build_cache_key(const char *input, str_set_t sources,
+                                   const char *flags);
+
+// copies the binary and the C code cached for key to output and c_output
+// returns whether the cache held them
+bool build_cache_fetch(unsigned long long key, const char *output,
+                       const char *c_output);
+
+// caches the binary output and the C code c_output built for key
+void build_cache_store(unsigned long long key, const char *output,
+                       const char *c_output);
+
+#endif // BUILD_CACHE_H
@@ -0,0 +1,22 @@
+// CACHE HEADER FILE
+// Paul Passeron
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define CACHE_HASH_SEED 14695981039346656037ULL
+
+// creates the directory of the caches, $XDG_CACHE_HOME/unilang or
+// ~/.cache/unilang, and returns whether it exists
+bool open_cache_dir(void);
+
+// the directory of the caches, valid once open_cache_dir succeeded
+const char *get_cache_dir(void);
+
+// FNV-1a hash of the n bytes at s, chained from h (CACHE_HASH_SEED first)
+unsigned long long cache_hash(unsigned long long h, const char *s, size_t n);
+
+#endif // CACHE_H
@@ -0,0 +1,42 @@
+// COMPTIME HEADER FILE
+// Paul Passeron
+
+#ifndef COMPTIME_H
+#define COMPTIME_H
+
+#include "fold.h"
+#include "ul_ast.h"
+#include <stdbool.h>
+
+// The evaluation of a call gives up after this many steps
+#define COMPTIME_MAX_STEPS 100000000
+#define COMPTIME_MAX_DEPTH 1024
+
+// An array built by a comptime function
+typedef struct comptime_array_t {
+  unsigned long long *items; // bits of the elements, see fold_int_t
+  size_t length;
+  size_t capacity;
+  const char *type; // type of the elements
+} comptime_array_t;
+
+// A value of the comptime interpreter: an integer or an array of integers
+typedef struct comptime_value_t {
+  fold_int_t i;            // width is 0 for the result of void functions
+  comptime_array_t *array; // NULL for integers
+} comptime_value_t;
+
+// finds the functions of prog marked comptime
+void analyse_comptime(ast_t prog);
+
+// returns whether funcall calls a function marked comptime
+bool is_comptime_call(ast_t funcall);
+
+// evaluates funcall if it calls a comptime function with constant arguments
+// returns whether it does, the result being stored in res
+// the arrays of the result stay valid until the next evaluation
+// exits with an error if the function uses anything else than integers,
+// arrays of integers and other comptime functions
+bool comptime_evaluate(ast_t funcall, comptime_value_t *res);
+
+#endif // COMPTIME_H
@@ -0,0 +1,53 @@
+// ESCAPE HEADER FILE
+// Paul Passeron
+
+#ifndef ESCAPE_H
+#define ESCAPE_H
+
+#include "ul_ast.h"
+#include "ul_dyn_arrays.h"
+#include <stdbool.h>
+
+#define MAX_SUMMARY_PARAMS 64
+
+// What a function does with its parameters, computed over the whole program
+typedef struct escape_summary_t {
+  ast_t fundef;
+  const char *method; // name of the method without its type, NULL for functions
+  // bit i is set if the value of parameter i may outlive the call (returned,
+  // stored somewhere or passed to a function that lets it escape)
+  unsigned long long escaping_params;
+  // bit i is set if the result may be an object reached from parameter i
+  // through its fields or elements, as with return this.field
+  unsigned long long aliased_params;
+} escape_summary_t;
+
+typedef __internal_dyn_array_t escape_summary_array_t;
+#define dyn_escape_get(arr, index) ul_dyn_get(arr, index, escape_summary_t)
+#define new_escape_dyn() new_dyn(escape_summary_t, false)
+
+// computes the summaries of all the functions and methods of prog
+void analyse_escapes(ast_t prog);
+
+// returns whether the parameter index of the function called name may escape
+// functions that are not defined in the program (runtime builtins) never
+// let their parameters escape
+bool param_escapes(const char *name, size_t index);
+
+// same as param_escapes for the methods called method, of any type, the
+// receiver being the last parameter
+bool method_param_escapes(const char *method, size_t index);
+
+// returns whether the result of the function called name may refer to what
+// its parameter index refers to, because the parameter escapes or because
+// an object reached from it is returned
+bool param_aliased(const char *name, size_t index);
+
+// same as param_aliased for the methods called method, of any type
+bool method_param_aliased(const char *method, size_t index);
+
+// returns whether the value of the variable name, local to fundef, may
+// outlive the call of fundef
+bool var_escapes(ast_t fundef, const char *name);
+
+#endif // ESCAPE_H
@@ -0,0 +1,73 @@
+// FOLD HEADER FILE
+// Paul Passeron
+
+#ifndef FOLD_H
+#define FOLD_H
+
+#include "ul_ast.h"
+#include "ul_dyn_arrays.h"
+#include <stdbool.h>
+
+#define FOLD_TEXT_SIZE 512
+
+typedef enum fold_kind_t { FOLD_INT, FOLD_STRING } fold_kind_t;
+
+// An integer as C would hold it
+typedef struct fold_int_t {
+  // stored sign extended when signed and zero extended otherwise
+  unsigned long long bits;
+  int width; // 8, 16, 32 or 64 bits
+  bool is_signed;
+} fold_int_t;
+
+// The value of a constant expression, as C would compute it
+typedef struct fold_value_t {
+  fold_kind_t kind;
+  fold_int_t i;
+  // strings are C string literals juxtaposed, quotes included
+  char text[FOLD_TEXT_SIZE];
+} fold_value_t;
+
+// A top level variable that is never assigned
+typedef struct fold_constant_t {
+  const char *name;
+  size_t var_index; // index of the variable in the context of the generator
+  fold_int_t value;
+} fold_constant_t;
+
+typedef __internal_dyn_array_t fold_constant_array_t;
+#define dyn_fold_constant_get(arr, index)                                      \
+  ul_dyn_get(arr, index, fold_constant_t)
+#define new_fold_constant_dyn() new_dyn(fold_constant_t, false)
+
+// finds the top level variables of prog that may be constants
+void analyse_constants(ast_t prog);
+
+// records the value of the top level vardef if it is a constant, before its
+// variable is added to the context of the generator
+// returns whether it is one, its value converted to its type in res
+bool register_constant(ast_t vardef, fold_value_t *res);
+
+// returns whether name is a constant registered so far, its value in res
+bool find_constant(const char *name, fold_int_t *res);
+
+// evaluates expr if it only depends on literals, constants and calls to
+// comptime functions
+// returns whether it could, the value being stored in res
+bool fold_expression(ast_t expr, fold_value_t *res);
+
+// value of the numeric or char literal lit
+// returns false for floats and literals that do not fit in a long
+bool fold_literal(ast_t lit, fold_int_t *res);
+
+// converts v to the builtin integer type called type
+// returns false if there is no such type
+bool fold_to_type(fold_int_t v, const char *type, fold_int_t *res);
+
+// applies the integer operation op to a and b
+// returns false if op is not one or C leaves its result undefined
+bool fold_int_binop(token_kind_t op, fold_int_t a, fold_int_t b,
+                    fold_int_t *res);
+bool fold_int_unary(token_kind_t op, fold_int_t a, fold_int_t *res);
+
+#endif // FOLD_H
@@ -6,6 +6,7 @@
 #ifndef GENERATOR_H
 #define GENERATOR_H
 #include "context.h"
+#include "incremental.h"
 #include "ul_ast.h"
 #include "ul_dyn_arrays.h"
 #include "ul_types.h"
@@ -15,11 +16,28 @@ typedef struct generator_t {
   FILE *target;
   context_t context;
   bool failed;
+  ast_t current_fundef; // function being generated, NULL at top level
+  bool regions;         // release the arenas of scopes that do not retain them
+  bool function_region; // a region is open for the whole current function
+  bool bounds_checked;  // check the indices of array accesses at runtime
+  bool alloc_stats;     // the program prints the statistics of its arenas
+  // loop variables that are valid indices of an array in the current loop,
+  // name being the variable and type the name of the array
+  var_array_t in_bounds;
+  bool incremental; // the program is split in parts, see incremental.c
+  part_t group;     // the part of the current group of functions
 } generator_t;
 
+extern generator_t generator;
+
 void set_generator_target(const char *target);
+// writes the parts of an incremental build in dir instead of a single target
+void set_generator_incremental(const char *dir);
 
 void destroy_generator(void);
+void set_generator_regions(bool enabled);
+void set_generator_bounds_checked(bool checked);
+void set_generator_alloc_stats(bool enabled);
 
 void generate_program(ast_t prog);
 void generate_prolog();
@@ -27,5 +45,7 @@ void generate_statement(ast_t stmt);
 void generate_expression(ast_t stmt);
 void generate_expression_with_type(ast_t stmt, ast_t type);
 bool has_failed(void);
+bool is_int_type(char *name);
+type_t get_type_of_expr(ast_t expr);
 
 #endif // GENERATOR_H
@@ -0,0 +1,37 @@
+// INCREMENTAL HEADER FILE
+// Paul Passeron
+
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// A group of functions starts at about one function out of this many
+#define INCREMENTAL_GROUP_SPAN 8
+#define PART_NAME_MAX 160
+
+// A file of an incremental build, only replaced if its contents changed so
+// that make does not rebuild what it compiles to
+typedef struct part_t {
+  FILE *f; // NULL if the part is not open
+  char name[PART_NAME_MAX];
+} part_t;
+
+// the parts are written in dir, that is created if needed
+void set_incremental_dir(const char *dir);
+
+part_t open_part(const char *name);
+void close_part(part_t *part);
+
+// returns whether a group of functions starts at the function called name
+// the groups only depend on the names of their functions, so that adding a
+// function only changes its own group
+bool starts_group(const char *name);
+
+// removes the parts of earlier builds that were not written this time,
+// then builds output from the parts with make
+// returns whether the build succeeded
+bool build_parts(const char *output, const char *opt_level);
+
+#endif // INCREMENTAL_H
@@ -0,0 +1,20 @@
+// INLINE HEADER FILE
+// Paul Passeron
+
+#ifndef INLINE_H
+#define INLINE_H
+
+#include "ul_ast.h"
+#include <stdbool.h>
+
+// Functions made of at most this many nodes are small enough to be inlined
+#define INLINE_MAX_NODES 24
+
+// finds the functions and methods defined by prog
+void analyse_inlining(ast_t prog);
+
+// returns whether fundef should be emitted static inline: it is marked
+// inline, or it is small and does not call any function of the program
+bool is_inline_function(ast_t fundef);
+
+#endif // INLINE_H
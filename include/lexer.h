@@ -19,6 +19,18 @@ typedef enum lexer_state_t {
 
 const char *lexer_state_to_str(lexer_state_t state);
 
+// An @include directive met by a lexer
+typedef struct lexer_include_t {
+  char *name;   // as written in the directive
+  size_t index; // index in the tokens of the first included token
+  size_t count; // number of tokens included, 0 if the file already was
+} lexer_include_t;
+
+typedef __internal_dyn_array_t lexer_include_array_t;
+#define dyn_lexer_include_get(arr, index)                                      \
+  ul_dyn_get(arr, index, lexer_include_t)
+#define new_lexer_include_dyn() new_dyn(lexer_include_t, false)
+
 typedef struct lexer_t {
   char *buffer;
   size_t buffer_length;
@@ -27,6 +39,8 @@ typedef struct lexer_t {
   char *filename;
   lexer_state_t state;
   token_array_t toks;
+  size_t first_token; // index in toks of the first token of this file
+  lexer_include_array_t includes;
   unsigned int arena;
 } lexer_t;
 
@@ -38,5 +52,8 @@ char peek_n_chars(lexer_t l, size_t n);
 bool is_end_of_file(lexer_t l);
 bool step_lexer(lexer_t *l);
 void lex_program(lexer_t *l);
+// appends the tokens of the file at path, and of the files it includes, to
+// toks, reusing the token cache when it holds them
+void lex_file(token_array_t *toks, char *path);
 
 #endif // LEXER_H
\ No newline at end of file
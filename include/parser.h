@@ -15,6 +15,7 @@ typedef struct parser_t {
   token_array_t toks;
   size_t current_index;
   unsigned int arena;
+  ast_array_t map_types; // map[K, V] types met so far, see parse_type
 } parser_t;
 
 // returns a fresh parser
@@ -0,0 +1,18 @@
+// REACH HEADER FILE
+// Paul Passeron
+
+#ifndef REACH_H
+#define REACH_H
+
+#include "ul_ast.h"
+#include <stdbool.h>
+
+// finds the functions, methods and struct types that entry can reach
+void analyse_reachability(ast_t prog);
+
+// returns whether the top level statement or method stmt has to be emitted:
+// functions and methods that may be called, and the struct types that are
+// used. Anything else is always emitted
+bool is_reachable(ast_t stmt);
+
+#endif // REACH_H
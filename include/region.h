@@ -0,0 +1,44 @@
+// REGION HEADER FILE
+// Paul Passeron
+
+#ifndef REGION_H
+#define REGION_H
+
+#include "ul_ast.h"
+#include "ul_dyn_arrays.h"
+#include <stdbool.h>
+
+// Where the objects reachable from a variable may come from
+#define FROM_PARAMS 1  // the arguments of the function being analysed
+#define FROM_OUTSIDE 2 // a global or a variable declared before the scope
+#define RETURNS 4      // the scope contains a return statement
+#define ALLOCATES 8    // the scope may create arenas
+
+// What a function may do with the allocations it makes
+typedef struct region_summary_t {
+  ast_t fundef;
+  const char *name; // mangled for methods
+  // FROM_PARAMS if it may store them into its arguments, FROM_OUTSIDE if it
+  // may store them into globals, ALLOCATES if it may allocate at all
+  int stores;
+} region_summary_t;
+
+typedef __internal_dyn_array_t region_summary_array_t;
+#define dyn_region_summary_get(arr, index)                                     \
+  ul_dyn_get(arr, index, region_summary_t)
+#define new_region_summary_dyn() new_dyn(region_summary_t, false)
+
+// computes the summaries of all the functions and methods of prog
+// the types of prog must already be known to the generator
+void analyse_regions(ast_t prog);
+
+// returns whether stmt may allocate and everything it allocates is
+// unreachable once it is done, the variables in scope being those of the
+// generator
+bool scope_is_releasable(ast_t stmt);
+
+// returns whether fundef may allocate and everything it allocates is
+// unreachable once it returns
+bool function_is_releasable(ast_t fundef);
+
+#endif // REGION_H
@@ -0,0 +1,31 @@
+// STR_SET HEADER FILE
+// Paul Passeron
+
+#ifndef STR_SET_H
+#define STR_SET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define STR_SET_INIT_CAP 64
+
+// A set of strings, hashed with open addressing
+// The strings are not copied and must outlive the set
+typedef struct str_set_t {
+  const char **slots; // NULL for empty slots
+  size_t capacity;    // always a power of two
+  size_t count;
+  unsigned int arena;
+} str_set_t;
+
+str_set_t new_str_set(void);
+void destroy_str_set(str_set_t set);
+
+bool str_set_contains(str_set_t set, const char *s);
+// index of s in set.slots, -1 if s is not in the set
+// the indices change when the set grows
+long str_set_index(str_set_t set, const char *s);
+// returns false if s was already in the set
+bool str_set_insert(str_set_t *set, const char *s);
+
+#endif // STR_SET_H
@@ -0,0 +1,40 @@
+// TIME_REPORT HEADER FILE
+// Paul Passeron
+
+#ifndef TIME_REPORT_H
+#define TIME_REPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// The phases of a compilation, in order
+typedef enum phase_t {
+  PHASE_LEXER,
+  PHASE_PARSER,
+  PHASE_GENERATOR,
+  PHASE_BACKEND, // formatting and compiling the generated C code
+  PHASE_COUNT
+} phase_t;
+
+// What a compilation creates, counted for the report
+typedef enum report_count_t {
+  COUNT_TOKENS,
+  COUNT_AST_NODES,
+  COUNT_TYPES,
+  COUNT_VARS, // in scope at the end: the top level ones and enum members
+  COUNT_COUNT
+} report_count_t;
+
+// --time-report, or --time-report=json: nothing is measured otherwise
+void enable_time_report(bool json);
+
+void begin_phase(phase_t phase);
+void end_phase(phase_t phase);
+void set_report_count(report_count_t which, size_t count);
+
+// prints the wall time, CPU time (including that of the processes phases
+// wait for) and peak arena bytes of each phase that ran, then the counts,
+// as a table or as a JSON object on one line
+void print_time_report(void);
+
+#endif // TIME_REPORT_H
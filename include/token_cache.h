@@ -0,0 +1,42 @@
+// TOKEN_CACHE HEADER FILE
+// Paul Passeron
+
+#ifndef TOKEN_CACHE_H
+#define TOKEN_CACHE_H
+
+#include "lexer.h"
+#include <stdbool.h>
+
+// Bumped whenever the tokens or the layout of the entries change
+#define TOKEN_CACHE_VERSION 1
+// kind of the cached tokens standing for an @include directive
+#define CACHED_INCLUDE 0xffffffffu
+
+// A token as stored in the cache
+typedef struct cached_token_t {
+  unsigned int kind; // token_kind_t, or CACHED_INCLUDE
+  unsigned int line;
+  unsigned int col;
+  unsigned int lexeme; // offset of the lexeme, or of the included name
+} cached_token_t;
+
+// The tokens of a file, mapped from the cache
+typedef struct token_cache_entry_t {
+  cached_token_t *toks;
+  size_t count;
+  char *strings; // the lexemes, each followed by a '\0'
+} token_cache_entry_t;
+
+// enables the cache, kept in the directory of the caches (see cache.h) that
+// must have been opened
+void enable_token_cache(void);
+
+// maps the entry of the file at path if the cache holds its current tokens,
+// checked with its modification time and size, then with a hash of its
+// contents if they changed
+bool token_cache_load(const char *path, token_cache_entry_t *res);
+
+// stores the tokens lexed by l from the file at path
+void token_cache_store(const char *path, lexer_t l);
+
+#endif // TOKEN_CACHE_H
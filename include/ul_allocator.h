@@ -9,15 +9,45 @@ typedef struct arena_t {
   size_t size;
   size_t fill;
   void *contents;
+  int tag; // index of the statistics of its creator, -1 if not tracked
 } arena_t;
 
-unsigned int new_arena(size_t size);
+typedef struct allocator_stats_t {
+  size_t arenas_created;
+  size_t live_bytes; // sizes of the arenas that are not destroyed
+  size_t peak_bytes; // highest live_bytes since the last reset_allocator_peak
+} allocator_stats_t;
+
+// Statistics of the arenas created by a function, see --alloc-stats
+typedef struct arena_tag_stats_t {
+  const char *tag; // name of the function
+  size_t created;
+  size_t live; // arenas not destroyed yet
+  size_t live_bytes;
+  size_t peak_bytes; // highest live_bytes
+  size_t requested;  // sizes of the arenas
+  size_t used;       // bytes allocated from them
+} arena_tag_stats_t;
+
+#define MAX_ARENA_TAGS 256
+
+// arenas are tagged with the function that creates them
+#define new_arena(size) new_tagged_arena(size, __func__)
+unsigned int new_tagged_arena(size_t size, const char *tag);
 void destroy_arena(unsigned int id);
 void set_arena(unsigned int id);
 unsigned int get_arena(void);
 
 void clear_allocator(void);
 
+allocator_stats_t get_allocator_stats(void);
+void reset_allocator_peak(void);
+
+// keeps statistics per tag for the arenas created from now on
+void enable_alloc_stats(void);
+// prints the statistics per tag, if enabled, and the arenas still alive
+void print_alloc_stats(void);
+
 void *alloc_preset(size_t n, size_t s, char value);
 void *alloc_preset_ptr(size_t n, size_t s, char *value);
 void *alloc_zero(size_t n, size_t s);
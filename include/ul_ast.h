@@ -62,6 +62,7 @@ typedef struct ast_binop_t {
   token_kind_t op; // kind of operation (should be the token kind)
   ast_t left;      // left operand
   ast_t right;     // right operand
+  ast_t first;     // leftmost operand that is not a binop, giving the type
 } ast_binop_t;
 
 // Unary operation ast node
@@ -80,6 +81,7 @@ typedef struct ast_iden_t {
 // Program ast node
 typedef struct ast_prog_t {
   ast_array_t prog; // dynamic array of ast nodes that represent the program
+  ast_array_t map_types; // one type node for each map[K, V] used
 } ast_prog_t;
 
 // Function defenition parameter ast node
@@ -93,6 +95,8 @@ typedef struct ast_fundef_t {
   ast_t return_type;  // the return type of the function
   char *name;         // the name of the function
   ast_array_t body;
+  bool is_comptime;   // evaluated when compiling with constant arguments
+  bool is_inline;     // emitted static inline, see inline.c
 } ast_fundef_t;
 
 typedef struct ast_funcall_t {
@@ -156,6 +160,9 @@ typedef struct ast_assign_t {
 typedef struct ast_type_t {
   char *name;
   int list_n;
+  bool is_slice; // the outermost '[]' is written '[..]'
+  ast_t key;     // key type of map[K, V] types, NULL for the others
+  ast_t value;   // value type of map[K, V] types
 } ast_type_t;
 
 typedef struct ast_iter_t {
@@ -195,6 +202,9 @@ struct ast_struct_t {
   ast_kind_t kind;
   ast_as_t as;
   location_t loc;
+  // set by fold.c: -1 once the node is known not to be constant, the index
+  // of the result + 1 for folded calls to comptime functions
+  int fold_index;
 };
 
 ast_t new_strlit(location_t loc, char *content);
@@ -220,9 +230,12 @@ ast_t new_index(location_t loc, ast_t value, ast_t index);
 ast_t new_access(location_t loc, ast_t object, ast_t field);
 ast_t new_tdef(location_t loc, type_t type);
 ast_t new_assignement(location_t loc, ast_t expr, ast_t value);
-ast_t new_type(location_t loc, char *name, int list_n);
+ast_t new_type(location_t loc, char *name, int list_n, bool is_slice);
 ast_t new_iter(location_t loc, ast_t var, ast_t itered, ast_t stmt);
 
 const char *ast_kind_to_str(ast_kind_t kind);
 
+// number of nodes created so far
+size_t ast_nodes_count(void);
+
 #endif // UL_AST_H
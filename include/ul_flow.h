@@ -1,10 +1,40 @@
 #ifndef UL_FLOW_H
 #define UL_FLOW_H
 
-void ul_start(int argc, char **argv);
+#include "logger.h"
+#include <stdbool.h>
 
-void ul_end(void);
+// The options of a compilation, from the command line
+typedef struct ul_options_t {
+  logger_severity_t severity;
+  char *input;  // NULL if none was given
+  char *output; // NULL for a.out
+  char *opt_level;
+  bool regions;
+  bool bounds_checked;
+  bool caches;      // the token and the build caches
+  bool incremental; // see incremental.c
+  bool time_report; // see time_report.c
+  bool time_report_json;
+  bool alloc_stats; // in the compiler and in the programs it compiles
+  bool watch;       // see watch.c
+  char *daemon;     // socket of --daemon, NULL if not given
+  char *connect;    // socket of --connect, NULL if not given
+  int sources_fd;   // the paths of the sources are written there if >= 0
+} ul_options_t;
+
+// returns the exit status of the compiler
+unsigned char ul_start(int argc, char **argv);
+
+void ul_parse_options(int argc, char **argv, ul_options_t *res);
+
+// compiles options.input, returning 0 on success and 1 if the program or
+// the generated C code failed to compile
+unsigned char ul_compile(ul_options_t options);
+
+// prints the reports and exits with exit_code
+void ul_end(unsigned char exit_code);
 
 void ul_exit(unsigned char exit_code);
 
-#endif // UL_FLOW_H
\ No newline at end of file
+#endif // UL_FLOW_H
@@ -14,6 +14,7 @@ typedef enum type_kind_t {
   TY_ENUM,
   TY_PRIMITIVE,
   TY_ARRAY,
+  TY_MAP, // members_types holds the key and the value types
 } type_kind_t;
 
 typedef struct type_t {
@@ -26,6 +27,7 @@ typedef struct type_t {
   bool is_signed;
   size_t size;
   int list_n; // if kind = TY_ARRAY then type is name []...[] with n '[]'
+  bool is_slice; // the outermost '[]' is a slice '[..]'
 } type_t;
 
 #endif // UL_TYPES_H
@@ -0,0 +1,30 @@
+// WATCH HEADER FILE
+// Paul Passeron
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "str_set.h"
+#include "ul_flow.h"
+
+#define WATCH_MAX_DIRS 1024
+#define WATCH_DEBOUNCE_MS 50
+#define REQUEST_MAX_SIZE (64 * 1024)
+#define REQUEST_MAX_ARGS 256
+
+// writes the paths of input and the files it includes to fd, then closes it
+void send_sources(int fd, const char *input, str_set_t sources);
+
+// compiles options.input again each time one of its sources changes
+void watch_program(ul_options_t options);
+
+// compiles the programs that the clients of the Unix socket at path ask for
+// the paths of a request are relative to the working directory of its client
+void serve_requests(const char *path);
+
+// asks the daemon listening at path to compile with the arguments of argv,
+// printing its output
+// returns the exit status of the compilation
+unsigned char send_request(const char *path, int argc, char **argv);
+
+#endif // WATCH_H
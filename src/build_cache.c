@@ -0,0 +1,189 @@
+// BUILD_CACHE SOURCE FILE
+// Paul Passeron
+
+// Cache of whole builds, in the builds directory of the caches.
+// A build is keyed on the contents of the compiler, of its C templates and
+// of every source of the program, and on the flags given to the backend.
+// On a hit, the binary and the C code are copied from the cache and nothing
+// is generated nor compiled.
+
+#include "../include/build_cache.h"
+#include "../include/cache.h"
+#include "../include/logger.h"
+#include "../include/ul_allocator.h"
+#include "../include/ul_assert.h"
+#include "../include/ul_io.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#define BUILD_PATH_MAX (PATH_MAX + 64)
+
+static unsigned long long hash_file(unsigned long long h, const char *path) {
+  struct stat st;
+  if (stat(path, &st) != 0)
+    return h;
+  unsigned int old_arena = get_arena();
+  unsigned int arena = new_arena(st.st_size + 1);
+  set_arena(arena);
+  char *buffer;
+  size_t length;
+  read_file(path, &buffer, &length);
+  h = cache_hash(h, buffer, length);
+  set_arena(old_arena);
+  destroy_arena(arena);
+  return h;
+}
+
+static int compare_paths(const void *a, const void *b) {
+  return strcmp(*(const char **)a, *(const char **)b);
+}
+
+unsigned long long build_cache_key(const char *input, str_set_t sources,
+                                   const char *flags) {
+  unsigned long long h = CACHE_HASH_SEED;
+  h = hash_file(h, "/proc/self/exe");
+  h = hash_file(h, "src/template/prologue.c");
+  h = hash_file(h, "src/template/epilogue.c");
+  h = cache_hash(h, flags, strlen(flags) + 1);
+  // the sources in a stable order, as the set has none
+  const char **paths = malloc((sources.count + 1) * sizeof(char *));
+  ul_assert(paths != NULL, "Could not allocate the sources of the build");
+  size_t count = 0;
+  char input_path[PATH_MAX] = {0};
+  if (realpath(input, input_path) != NULL &&
+      !str_set_contains(sources, input_path))
+    paths[count++] = input_path;
+  for (size_t i = 0; i < sources.capacity; i++) {
+    if (sources.slots[i] != NULL)
+      paths[count++] = sources.slots[i];
+  }
+  qsort(paths, count, sizeof(char *), compare_paths);
+  for (size_t i = 0; i < count; i++) {
+    h = cache_hash(h, paths[i], strlen(paths[i]) + 1);
+    h = hash_file(h, paths[i]);
+  }
+  free(paths);
+  return h;
+}
+
+static void entry_path(unsigned long long key, const char *ext, char *res) {
+  snprintf(res, BUILD_PATH_MAX, "%s/builds/%016llx.%s", get_cache_dir(), key,
+           ext);
+}
+
+// copies src to dst through a temporary file, so that dst is never partial
+static bool copy_file(const char *src, const char *dst, mode_t mode) {
+  char tmp[BUILD_PATH_MAX + 32];
+  snprintf(tmp, sizeof(tmp), "%s.%d", dst, (int)getpid());
+  int in = open(src, O_RDONLY);
+  if (in < 0)
+    return false;
+  int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, mode);
+  if (out < 0) {
+    close(in);
+    return false;
+  }
+  char buffer[65536];
+  ssize_t n;
+  bool ok = true;
+  while (ok && (n = read(in, buffer, sizeof(buffer))) > 0)
+    ok = write(out, buffer, n) == n;
+  ok = ok && n == 0;
+  close(in);
+  ok = close(out) == 0 && ok;
+  if (!ok || rename(tmp, dst) != 0) {
+    remove(tmp);
+    return false;
+  }
+  return true;
+}
+
+bool build_cache_fetch(unsigned long long key, const char *output,
+                       const char *c_output) {
+  char bin[BUILD_PATH_MAX];
+  char c[BUILD_PATH_MAX];
+  entry_path(key, "bin", bin);
+  entry_path(key, "c", c);
+  if (access(bin, R_OK) != 0 || access(c, R_OK) != 0)
+    return false;
+  if (!copy_file(bin, output, 0755) || !copy_file(c, c_output, 0644))
+    return false;
+  // most recently used
+  utime(bin, NULL);
+  utime(c, NULL);
+  return true;
+}
+
+typedef struct build_file_t {
+  char name[NAME_MAX + 1];
+  time_t mtime;
+  off_t size;
+} build_file_t;
+
+static int compare_mtimes(const void *a, const void *b) {
+  time_t ma = ((const build_file_t *)a)->mtime;
+  time_t mb = ((const build_file_t *)b)->mtime;
+  return (ma > mb) - (ma < mb);
+}
+
+// removes the least recently used files once the cache is too large
+static void evict(const char *dir) {
+  DIR *d = opendir(dir);
+  if (d == NULL)
+    return;
+  build_file_t *files = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  unsigned long long total = 0;
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    char path[BUILD_PATH_MAX + NAME_MAX];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+      continue;
+    if (count == capacity) {
+      capacity = 2 * capacity + 16;
+      files = realloc(files, capacity * sizeof(build_file_t));
+      ul_assert(files != NULL, "Could not allocate the build cache files");
+    }
+    strcpy(files[count].name, e->d_name);
+    files[count].mtime = st.st_mtime;
+    files[count].size = st.st_size;
+    total += st.st_size;
+    count++;
+  }
+  closedir(d);
+  qsort(files, count, sizeof(build_file_t), compare_mtimes);
+  for (size_t i = 0; i < count && total > BUILD_CACHE_MAX_SIZE; i++) {
+    char path[BUILD_PATH_MAX + NAME_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, files[i].name);
+    if (remove(path) == 0)
+      total -= files[i].size;
+  }
+  free(files);
+}
+
+void build_cache_store(unsigned long long key, const char *output,
+                       const char *c_output) {
+  char dir[BUILD_PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s/builds", get_cache_dir());
+  mkdir(dir, 0755);
+  char bin[BUILD_PATH_MAX];
+  char c[BUILD_PATH_MAX];
+  entry_path(key, "bin", bin);
+  entry_path(key, "c", c);
+  // the binary last, as a build is only found once its binary is there
+  if (!copy_file(c_output, c, 0644) || !copy_file(output, bin, 0755)) {
+    ul_logger_warn("Could not store the build in the cache");
+    return;
+  }
+  evict(dir);
+}
@@ -0,0 +1,37 @@
+// CACHE SOURCE FILE
+// Paul Passeron
+
+#include "../include/cache.h"
+#include <errno.h>
+#include <linux/limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static char cache_dir[PATH_MAX];
+
+bool open_cache_dir(void) {
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if (xdg != NULL && *xdg != 0 && strlen(xdg) < PATH_MAX - 16) {
+    strcpy(cache_dir, xdg);
+  } else if (home != NULL && strlen(home) < PATH_MAX - 16) {
+    strcpy(cache_dir, home);
+    strcat(cache_dir, "/.cache");
+    mkdir(cache_dir, 0755);
+  } else {
+    return false;
+  }
+  strcat(cache_dir, "/unilang");
+  return mkdir(cache_dir, 0755) == 0 || errno == EEXIST;
+}
+
+const char *get_cache_dir(void) { return cache_dir; }
+
+unsigned long long cache_hash(unsigned long long h, const char *s, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
@@ -0,0 +1,501 @@
+// COMPTIME SOURCE FILE
+// Paul Passeron
+
+// Compile time evaluation of the functions marked comptime.
+// A call to such a function whose arguments are constants is run by a small
+// interpreter over the AST while the program is generated, and replaced by
+// its result: a literal for integers, static data for the arrays of top level
+// variables. The integers follow the C rules of fold.c, and anything the
+// generated code could not have computed the same way (overflow, division by
+// zero, out of bounds access) is reported as an error.
+// The values of the interpreter live in memory of its own, released before
+// each new evaluation, as their number is not known in advance.
+
+#include "../include/comptime.h"
+#include "../include/ul_assert.h"
+#include "../include/ul_compiler_globals.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct comptime_var_t {
+  const char *name;
+  const char *type; // type of the elements for arrays
+  int list_n;
+  comptime_value_t value;
+} comptime_var_t;
+
+typedef enum comptime_flow_t { CT_NEXT, CT_RETURN } comptime_flow_t;
+
+static ast_array_t comptime_functions;
+
+static struct {
+  comptime_var_t *vars;
+  size_t vars_length;
+  size_t vars_capacity;
+  size_t frame; // first variable of the function being run
+  comptime_array_t **arrays;
+  size_t arrays_length;
+  size_t arrays_capacity;
+  size_t steps;
+  size_t depth;
+  comptime_value_t ret;
+  ast_t call; // the call being evaluated, for the errors
+} interp;
+
+static void comptime_error(location_t loc, const char *msg) {
+  char buf[512];
+  snprintf(buf, sizeof(buf), "comptime evaluation of %s: %s",
+           interp.call->as.funcall->name, msg);
+  ul_assert_location(loc, false, buf);
+}
+
+static void *comptime_realloc(void *ptr, size_t size) {
+  void *res = realloc(ptr, size);
+  ul_assert(res != NULL, "comptime: Could not allocate memory");
+  return res;
+}
+
+void analyse_comptime(ast_t prog) {
+  comptime_functions = new_ast_dyn();
+  ast_array_t contents = prog->as.prog->prog;
+  for (size_t i = 0; i < ul_dyn_length(contents); i++) {
+    ast_t stmt = dyn_ast_get(contents, i);
+    if (stmt->kind == A_FUNDEF && stmt->as.fundef->is_comptime)
+      ul_dyn_append(&comptime_functions, stmt);
+  }
+}
+
+static ast_t find_comptime(const char *name) {
+  for (size_t i = 0; i < ul_dyn_length(comptime_functions); i++) {
+    ast_t f = dyn_ast_get(comptime_functions, i);
+    if (streq(f->as.fundef->name, name))
+      return f;
+  }
+  return NULL;
+}
+
+bool is_comptime_call(ast_t funcall) {
+  return funcall->kind == A_FUNCALL &&
+         find_comptime(funcall->as.funcall->name) != NULL;
+}
+
+static comptime_array_t *new_comptime_array(const char *type) {
+  if (interp.arrays_length == interp.arrays_capacity) {
+    interp.arrays_capacity =
+        interp.arrays_capacity == 0 ? 16 : 2 * interp.arrays_capacity;
+    interp.arrays = comptime_realloc(
+        interp.arrays, interp.arrays_capacity * sizeof(comptime_array_t *));
+  }
+  comptime_array_t *arr = comptime_realloc(NULL, sizeof(comptime_array_t));
+  *arr = (comptime_array_t){.type = type};
+  interp.arrays[interp.arrays_length++] = arr;
+  return arr;
+}
+
+static void release_arrays(void) {
+  for (size_t i = 0; i < interp.arrays_length; i++) {
+    free(interp.arrays[i]->items);
+    free(interp.arrays[i]);
+  }
+  interp.arrays_length = 0;
+}
+
+static void step(ast_t node) {
+  if (++interp.steps > COMPTIME_MAX_STEPS)
+    comptime_error(node->loc, "too many steps, the function may not end");
+}
+
+// integer types only
+static fold_int_t to_type(ast_t node, fold_int_t v, const char *type) {
+  fold_int_t res;
+  if (!fold_to_type(v, type, &res))
+    comptime_error(node->loc, "only integers and arrays of integers can be "
+                              "used at compile time");
+  return res;
+}
+
+static void check_type(ast_t node, ast_t type) {
+  ast_type_t t = *type->as.type;
+  if (t.list_n > 1 || t.is_slice)
+    comptime_error(node->loc, "only integers and arrays of integers can be "
+                              "used at compile time");
+  to_type(node, (fold_int_t){.width = 64}, t.name);
+}
+
+static void push_var(const char *name, const char *type, int list_n,
+                     comptime_value_t value) {
+  if (interp.vars_length == interp.vars_capacity) {
+    interp.vars_capacity =
+        interp.vars_capacity == 0 ? 64 : 2 * interp.vars_capacity;
+    interp.vars = comptime_realloc(
+        interp.vars, interp.vars_capacity * sizeof(comptime_var_t));
+  }
+  interp.vars[interp.vars_length++] = (comptime_var_t){
+      .name = name, .type = type, .list_n = list_n, .value = value};
+}
+
+static comptime_var_t *find_var(const char *name) {
+  for (size_t i = interp.vars_length; i > interp.frame; i--) {
+    if (streq(interp.vars[i - 1].name, name))
+      return &interp.vars[i - 1];
+  }
+  return NULL;
+}
+
+static comptime_value_t eval(ast_t expr);
+static comptime_flow_t exec(ast_t stmt);
+
+static fold_int_t eval_int(ast_t expr) {
+  comptime_value_t v = eval(expr);
+  if (v.array != NULL || v.i.width == 0)
+    comptime_error(expr->loc, "expected an integer");
+  return v.i;
+}
+
+static comptime_array_t *eval_array(ast_t expr) {
+  comptime_value_t v = eval(expr);
+  if (v.array == NULL)
+    comptime_error(expr->loc, "expected an array");
+  return v.array;
+}
+
+static comptime_value_t int_value(fold_int_t i) {
+  return (comptime_value_t){.i = i, .array = NULL};
+}
+
+static fold_int_t element(ast_t node, comptime_array_t *arr, fold_int_t index) {
+  // negative indices are sign extended, hence out of bounds as well
+  if (index.bits >= arr->length)
+    comptime_error(node->loc, "index out of the bounds of the array");
+  fold_int_t v = {.bits = arr->items[index.bits], .width = 64};
+  return to_type(node, v, arr->type);
+}
+
+static void set_element(ast_t node, comptime_array_t *arr, fold_int_t index,
+                        fold_int_t v) {
+  element(node, arr, index);
+  arr->items[index.bits] = to_type(node, v, arr->type).bits;
+}
+
+static void append_element(ast_t node, comptime_array_t *arr, fold_int_t v) {
+  if (arr->length == arr->capacity) {
+    arr->capacity = arr->capacity == 0 ? 16 : 2 * arr->capacity;
+    arr->items = comptime_realloc(arr->items,
+                                  arr->capacity * sizeof(unsigned long long));
+  }
+  arr->items[arr->length++] = to_type(node, v, arr->type).bits;
+}
+
+static comptime_value_t call(ast_t funcall, comptime_value_t *args);
+
+static comptime_value_t eval_funcall(ast_t expr) {
+  ast_funcall_t f = *expr->as.funcall;
+  if (find_comptime(f.name) == NULL)
+    comptime_error(expr->loc, "only comptime functions can be called");
+  size_t n = ul_dyn_length(f.args);
+  comptime_value_t args[n > 0 ? n : 1];
+  for (size_t i = 0; i < n; i++)
+    args[i] = eval(dyn_ast_get(f.args, i));
+  return call(expr, args);
+}
+
+static comptime_value_t eval_method(ast_t expr) {
+  ast_access_t a = *expr->as.access;
+  if (a.field->kind != A_FUNCALL)
+    comptime_error(expr->loc, "only integers and arrays of integers can be "
+                              "used at compile time");
+  comptime_array_t *arr = eval_array(a.object);
+  ast_funcall_t f = *a.field->as.funcall;
+  size_t n = ul_dyn_length(f.args);
+  fold_int_t args[2];
+  for (size_t i = 0; i < n && i < 2; i++)
+    args[i] = eval_int(dyn_ast_get(f.args, i));
+  comptime_value_t none = {0};
+  // the length of arrays is a size_t in the generated code
+  if (streq(f.name, "length") && n == 0)
+    return int_value((fold_int_t){.bits = arr->length, .width = 64});
+  if (streq(f.name, "get") && n == 1)
+    return int_value(element(expr, arr, args[0]));
+  if (streq(f.name, "set") && n == 2) {
+    set_element(expr, arr, args[0], args[1]);
+    return none;
+  }
+  if (streq(f.name, "append") && n == 1) {
+    append_element(expr, arr, args[0]);
+    return none;
+  }
+  if (streq(f.name, "swap") && n == 2) {
+    fold_int_t x = element(expr, arr, args[0]);
+    set_element(expr, arr, args[0], element(expr, arr, args[1]));
+    set_element(expr, arr, args[1], x);
+    return none;
+  }
+  comptime_error(expr->loc, "this array method cannot be used at compile time");
+  return none;
+}
+
+static comptime_value_t eval_binop(ast_t expr) {
+  ast_binop_t b = *expr->as.binop;
+  fold_int_t l = eval_int(b.left);
+  fold_int_t res;
+  // the right operand of && and || is only evaluated when needed
+  if ((b.op == T_AND && l.bits == 0) || (b.op == T_OR && l.bits != 0))
+    return int_value((fold_int_t){.bits = b.op == T_OR, .width = 32,
+                                  .is_signed = true});
+  fold_int_t r = eval_int(b.right);
+  if (!fold_int_binop(b.op, l, r, &res))
+    comptime_error(expr->loc, "overflow or division by zero");
+  return int_value(res);
+}
+
+static comptime_value_t eval_iden(ast_t expr) {
+  const char *name = expr->as.iden->content;
+  comptime_var_t *v = find_var(name);
+  if (v != NULL)
+    return v->value;
+  fold_int_t c;
+  if (find_constant(name, &c))
+    return int_value(c);
+  if (streq(name, "true") || streq(name, "false"))
+    return int_value((fold_int_t){.bits = streq(name, "true"), .width = 32,
+                                  .is_signed = true});
+  comptime_error(expr->loc, "unknown variable");
+  return (comptime_value_t){0};
+}
+
+static comptime_value_t eval(ast_t expr) {
+  step(expr);
+  switch (expr->kind) {
+  case A_NUMLIT:
+  case A_CHARLIT: {
+    fold_int_t v;
+    if (!fold_literal(expr, &v))
+      comptime_error(expr->loc, "only integer literals can be used");
+    return int_value(v);
+  }
+  case A_IDEN:
+    return eval_iden(expr);
+  case A_BINOP:
+    return eval_binop(expr);
+  case A_UNARY: {
+    ast_unary_t u = *expr->as.unary;
+    fold_int_t res;
+    if (u.is_postfix || !fold_int_unary(u.op, eval_int(u.operand), &res))
+      comptime_error(expr->loc, "overflow in unary operation");
+    return int_value(res);
+  }
+  case A_INDEX: {
+    comptime_array_t *arr = eval_array(expr->as.index->value);
+    return int_value(element(expr, arr, eval_int(expr->as.index->index)));
+  }
+  case A_ACCESS:
+    return eval_method(expr);
+  case A_FUNCALL:
+    return eval_funcall(expr);
+  default:
+    comptime_error(expr->loc, "only integers and arrays of integers can be "
+                              "used at compile time");
+    return (comptime_value_t){0};
+  }
+}
+
+static void exec_vardef(ast_t stmt) {
+  ast_vardef_t v = *stmt->as.vardef;
+  ast_type_t t = *v.type->as.type;
+  check_type(stmt, v.type);
+  comptime_value_t value = {0};
+  if (t.list_n == 1)
+    value.array = v.value != NULL ? eval_array(v.value)
+                                  : new_comptime_array(t.name);
+  else
+    value.i = to_type(stmt, v.value != NULL ? eval_int(v.value)
+                                            : (fold_int_t){.width = 32},
+                      t.name);
+  push_var(v.name, t.name, t.list_n, value);
+}
+
+static void exec_assign(ast_t stmt) {
+  ast_assign_t a = *stmt->as.assign;
+  if (a.expr->kind != A_IDEN)
+    comptime_error(stmt->loc, "only variables can be assigned");
+  comptime_var_t *v = find_var(a.expr->as.iden->content);
+  if (v == NULL)
+    comptime_error(stmt->loc, "only local variables can be assigned");
+  comptime_value_t value = eval(a.value);
+  // the variable may move if the value pushes new ones
+  v = find_var(a.expr->as.iden->content);
+  if (v->list_n > 0) {
+    if (value.array == NULL)
+      comptime_error(stmt->loc, "expected an array");
+    v->value = value;
+  } else {
+    if (value.array != NULL || value.i.width == 0)
+      comptime_error(stmt->loc, "expected an integer");
+    v->value.i = to_type(stmt, value.i, v->type);
+  }
+}
+
+// runs stmt in a scope of its own
+static comptime_flow_t exec_scope(ast_t stmt) {
+  size_t l = interp.vars_length;
+  comptime_flow_t flow = exec(stmt);
+  interp.vars_length = l;
+  return flow;
+}
+
+// same semantics as the code of generate_loop
+static comptime_flow_t exec_loop(ast_t stmt) {
+  ast_loop_t l = *stmt->as.loop;
+  long long init = (long long)to_type(stmt, eval_int(l.init), "i32").bits;
+  long long end = (long long)to_type(stmt, eval_int(l.end), "i32").bits;
+  long long incr = end >= init ? 1 : -1;
+  size_t base = interp.vars_length;
+  fold_int_t i = {.bits = init, .width = 32, .is_signed = true};
+  push_var(l.varname, "i32", 0, int_value(i));
+  while (true) {
+    long long n = (long long)interp.vars[base].value.i.bits;
+    if (!(l.strict ? incr * n < incr * end : incr * n <= incr * end))
+      break;
+    if (exec_scope(l.stmt) == CT_RETURN) {
+      interp.vars_length = base;
+      return CT_RETURN;
+    }
+    i = interp.vars[base].value.i;
+    i.bits += incr;
+    interp.vars[base].value.i = to_type(stmt, i, "i32");
+  }
+  interp.vars_length = base;
+  return CT_NEXT;
+}
+
+static comptime_flow_t exec_iter(ast_t stmt) {
+  ast_iter_t it = *stmt->as.iter;
+  comptime_array_t *arr = eval_array(it.itered);
+  size_t base = interp.vars_length;
+  for (size_t i = 0; i < arr->length; i++) {
+    fold_int_t index = {.bits = i, .width = 64, .is_signed = false};
+    push_var(it.var->as.iden->content, arr->type, 0,
+             int_value(element(stmt, arr, index)));
+    comptime_flow_t flow = exec_scope(it.stmt);
+    interp.vars_length = base;
+    if (flow == CT_RETURN)
+      return CT_RETURN;
+  }
+  return CT_NEXT;
+}
+
+static comptime_flow_t exec(ast_t stmt) {
+  step(stmt);
+  switch (stmt->kind) {
+  case A_VARDEF:
+    exec_vardef(stmt);
+    return CT_NEXT;
+  case A_ASSIGN:
+    exec_assign(stmt);
+    return CT_NEXT;
+  case A_RETURN:
+    interp.ret = eval(stmt->as.retstmt->expr);
+    return CT_RETURN;
+  case A_COMPOUND: {
+    ast_array_t stmts = stmt->as.compound->stmts;
+    size_t l = interp.vars_length;
+    for (size_t i = 0; i < ul_dyn_length(stmts); i++) {
+      if (exec(dyn_ast_get(stmts, i)) == CT_RETURN) {
+        interp.vars_length = l;
+        return CT_RETURN;
+      }
+    }
+    interp.vars_length = l;
+    return CT_NEXT;
+  }
+  case A_IF: {
+    ast_if_t i = *stmt->as.ifstmt;
+    if (eval_int(i.condition).bits != 0)
+      return exec_scope(i.ifstmt);
+    if (i.elsestmt != NULL)
+      return exec_scope(i.elsestmt);
+    return CT_NEXT;
+  }
+  case A_WHILE: {
+    ast_while_t w = *stmt->as.whilestmt;
+    while (eval_int(w.condition).bits != 0) {
+      if (exec_scope(w.stmt) == CT_RETURN)
+        return CT_RETURN;
+    }
+    return CT_NEXT;
+  }
+  case A_LOOP:
+    return exec_loop(stmt);
+  case A_ITER:
+    return exec_iter(stmt);
+  default:
+    eval(stmt);
+    return CT_NEXT;
+  }
+}
+
+static comptime_value_t call(ast_t funcall, comptime_value_t *args) {
+  ast_fundef_t f = *find_comptime(funcall->as.funcall->name)->as.fundef;
+  size_t n = ul_dyn_length(f.params);
+  if (n != ul_dyn_length(funcall->as.funcall->args))
+    comptime_error(funcall->loc, "wrong number of arguments");
+  if (++interp.depth > COMPTIME_MAX_DEPTH)
+    comptime_error(funcall->loc, "too many nested calls");
+  size_t frame = interp.frame;
+  size_t base = interp.vars_length;
+  for (size_t i = 0; i < n; i++) {
+    ast_fundef_param_t p = *dyn_ast_get(f.params, i)->as.fundef_param;
+    ast_type_t t = *p.type->as.type;
+    check_type(funcall, p.type);
+    comptime_value_t v = args[i];
+    if ((t.list_n > 0) != (v.array != NULL) ||
+        (v.array == NULL && v.i.width == 0))
+      comptime_error(funcall->loc, "argument of the wrong type");
+    if (v.array == NULL)
+      v.i = to_type(funcall, v.i, t.name);
+    push_var(p.name, t.name, t.list_n, v);
+  }
+  interp.frame = base;
+  comptime_value_t res = {0};
+  bool returned = false;
+  for (size_t i = 0; i < ul_dyn_length(f.body) && !returned; i++)
+    returned = exec(dyn_ast_get(f.body, i)) == CT_RETURN;
+  ast_type_t ret = *f.return_type->as.type;
+  if (!streq(ret.name, "void")) {
+    check_type(funcall, f.return_type);
+    if (!returned)
+      comptime_error(funcall->loc, "the function did not return a value");
+    res = interp.ret;
+    if ((ret.list_n > 0) != (res.array != NULL) ||
+        (res.array == NULL && res.i.width == 0))
+      comptime_error(funcall->loc, "returned value of the wrong type");
+    if (res.array == NULL)
+      res.i = to_type(funcall, res.i, ret.name);
+  }
+  interp.vars_length = base;
+  interp.frame = frame;
+  interp.depth--;
+  return res;
+}
+
+bool comptime_evaluate(ast_t funcall, comptime_value_t *res) {
+  if (!is_comptime_call(funcall))
+    return false;
+  ast_funcall_t f = *funcall->as.funcall;
+  size_t n = ul_dyn_length(f.args);
+  comptime_value_t args[n > 0 ? n : 1];
+  for (size_t i = 0; i < n; i++) {
+    fold_value_t v;
+    if (!fold_expression(dyn_ast_get(f.args, i), &v) || v.kind != FOLD_INT)
+      return false;
+    args[i] = int_value(v.i);
+  }
+  release_arrays();
+  interp.vars_length = 0;
+  interp.frame = 0;
+  interp.steps = 0;
+  interp.depth = 0;
+  interp.call = funcall;
+  *res = call(funcall, args);
+  return true;
+}
@@ -0,0 +1,321 @@
+// ESCAPE SOURCE FILE
+// Paul Passeron
+
+// Escape analysis over the AST.
+// A value escapes a function if it may still be reachable once the function
+// returns: it is returned, stored into another variable or object, or passed
+// to a function that lets the corresponding parameter escape. The parameters
+// summaries are computed for the whole program as a fixpoint, starting from
+// "nothing escapes" and growing until no summary changes.
+
+#include "../include/escape.h"
+#include "../include/ul_compiler_globals.h"
+#include <string.h>
+
+escape_summary_array_t escape_summaries;
+
+// Builtin array methods that store their arguments into the array, or whose
+// result views the receiver
+static const char *storing_methods[] = {"append", "set", "slice"};
+
+static bool is_var(ast_t expr, const char *name) {
+  return expr != NULL && expr->kind == A_IDEN &&
+         streq(expr->as.iden->content, name);
+}
+
+static bool summary_lets_escape(escape_summary_t s, size_t index) {
+  if (index >= MAX_SUMMARY_PARAMS)
+    return true;
+  return (s.escaping_params >> index) & 1;
+}
+
+static bool summary_aliases(escape_summary_t s, size_t index) {
+  if (index >= MAX_SUMMARY_PARAMS)
+    return true;
+  return ((s.escaping_params | s.aliased_params) >> index) & 1;
+}
+
+bool param_escapes(const char *name, size_t index) {
+  for (size_t i = 0; i < ul_dyn_length(escape_summaries); i++) {
+    escape_summary_t s = dyn_escape_get(escape_summaries, i);
+    if (s.method == NULL && streq(s.fundef->as.fundef->name, name)) {
+      return summary_lets_escape(s, index);
+    }
+  }
+  return false;
+}
+
+// The type of the receiver is not known here, so every method with that name
+// is considered
+bool method_param_escapes(const char *method, size_t index) {
+  for (size_t i = 0; i < sizeof(storing_methods) / sizeof(char *); i++) {
+    if (streq(method, storing_methods[i]))
+      return true;
+  }
+  bool found = false;
+  for (size_t i = 0; i < ul_dyn_length(escape_summaries); i++) {
+    escape_summary_t s = dyn_escape_get(escape_summaries, i);
+    if (s.method != NULL && streq(s.method, method)) {
+      found = true;
+      if (summary_lets_escape(s, index))
+        return true;
+    }
+  }
+  return !found;
+}
+
+bool param_aliased(const char *name, size_t index) {
+  for (size_t i = 0; i < ul_dyn_length(escape_summaries); i++) {
+    escape_summary_t s = dyn_escape_get(escape_summaries, i);
+    if (s.method == NULL && streq(s.fundef->as.fundef->name, name)) {
+      return summary_aliases(s, index);
+    }
+  }
+  return false;
+}
+
+bool method_param_aliased(const char *method, size_t index) {
+  if (method_param_escapes(method, index))
+    return true;
+  for (size_t i = 0; i < ul_dyn_length(escape_summaries); i++) {
+    escape_summary_t s = dyn_escape_get(escape_summaries, i);
+    if (s.method != NULL && streq(s.method, method) &&
+        summary_aliases(s, index))
+      return true;
+  }
+  return false;
+}
+
+static bool leaks(ast_t node, const char *name);
+
+static bool leaks_array(ast_array_t nodes, const char *name) {
+  for (size_t i = 0; i < ul_dyn_length(nodes); i++) {
+    if (leaks(dyn_ast_get(nodes, i), name))
+      return true;
+  }
+  return false;
+}
+
+static bool leaks_call(ast_funcall_t f, const char *method, const char *name) {
+  for (size_t i = 0; i < ul_dyn_length(f.args); i++) {
+    ast_t arg = dyn_ast_get(f.args, i);
+    if (is_var(arg, name)) {
+      bool escapes = method == NULL ? param_escapes(f.name, i)
+                                    : method_param_escapes(method, i);
+      if (escapes)
+        return true;
+    }
+  }
+  return leaks_array(f.args, name);
+}
+
+// returns whether the value of the variable name escapes in node
+static bool leaks(ast_t node, const char *name) {
+  if (node == NULL)
+    return false;
+  switch (node->kind) {
+  case A_RETURN: {
+    ast_return_t r = *node->as.retstmt;
+    return is_var(r.expr, name) || leaks(r.expr, name);
+  }
+  case A_ASSIGN: {
+    ast_assign_t a = *node->as.assign;
+    return is_var(a.value, name) || leaks(a.expr, name) ||
+           leaks(a.value, name);
+  }
+  case A_VARDEF: {
+    ast_vardef_t v = *node->as.vardef;
+    return is_var(v.value, name) || leaks(v.value, name);
+  }
+  case A_FUNCALL:
+    return leaks_call(*node->as.funcall, NULL, name);
+  case A_ACCESS: {
+    ast_access_t a = *node->as.access;
+    if (a.field->kind == A_FUNCALL) {
+      ast_funcall_t f = *a.field->as.funcall;
+      // the receiver is passed as the last parameter, this
+      if (is_var(a.object, name) &&
+          method_param_escapes(f.name, ul_dyn_length(f.args)))
+        return true;
+      if (leaks_call(f, f.name, name))
+        return true;
+    }
+    return leaks(a.object, name);
+  }
+  case A_BINOP: {
+    ast_binop_t b = *node->as.binop;
+    // '+' on strings builds a new string from its operands
+    if (b.op == T_PLUS && (is_var(b.left, name) || is_var(b.right, name)))
+      return true;
+    return leaks(b.left, name) || leaks(b.right, name);
+  }
+  case A_UNARY:
+    return leaks(node->as.unary->operand, name);
+  case A_INDEX:
+    return leaks(node->as.index->value, name) ||
+           leaks(node->as.index->index, name);
+  case A_COMPOUND:
+    return leaks_array(node->as.compound->stmts, name);
+  case A_IF: {
+    ast_if_t i = *node->as.ifstmt;
+    return leaks(i.condition, name) || leaks(i.ifstmt, name) ||
+           leaks(i.elsestmt, name);
+  }
+  case A_WHILE:
+    return leaks(node->as.whilestmt->condition, name) ||
+           leaks(node->as.whilestmt->stmt, name);
+  case A_LOOP: {
+    ast_loop_t l = *node->as.loop;
+    return leaks(l.init, name) || leaks(l.end, name) || leaks(l.stmt, name);
+  }
+  case A_ITER: {
+    ast_iter_t i = *node->as.iter;
+    // iterating over a struct calls its next() and get() methods
+    return is_var(i.itered, name) || leaks(i.itered, name) ||
+           leaks(i.stmt, name);
+  }
+  default:
+    return false;
+  }
+}
+
+// returns whether expr may be an object reached from the variable name
+static bool is_part_of(ast_t expr, const char *name) {
+  if (expr == NULL)
+    return false;
+  switch (expr->kind) {
+  case A_IDEN:
+    return is_var(expr, name);
+  case A_ACCESS: {
+    ast_access_t a = *expr->as.access;
+    if (a.field->kind != A_FUNCALL)
+      return is_part_of(a.object, name);
+    ast_funcall_t f = *a.field->as.funcall;
+    // the receiver is passed as the last parameter, this
+    if (is_part_of(a.object, name) &&
+        method_param_aliased(f.name, ul_dyn_length(f.args)))
+      return true;
+    for (size_t i = 0; i < ul_dyn_length(f.args); i++) {
+      if (is_part_of(dyn_ast_get(f.args, i), name) &&
+          method_param_aliased(f.name, i))
+        return true;
+    }
+    return false;
+  }
+  case A_FUNCALL: {
+    ast_funcall_t f = *expr->as.funcall;
+    for (size_t i = 0; i < ul_dyn_length(f.args); i++) {
+      if (is_part_of(dyn_ast_get(f.args, i), name) &&
+          param_aliased(f.name, i))
+        return true;
+    }
+    return false;
+  }
+  case A_INDEX:
+    return is_part_of(expr->as.index->value, name);
+  default:
+    return false;
+  }
+}
+
+// returns whether a return statement of node may give an object reached
+// from the variable name
+static bool returns_part_of(ast_t node, const char *name) {
+  if (node == NULL)
+    return false;
+  switch (node->kind) {
+  case A_RETURN:
+    return is_part_of(node->as.retstmt->expr, name);
+  case A_COMPOUND: {
+    ast_array_t stmts = node->as.compound->stmts;
+    for (size_t i = 0; i < ul_dyn_length(stmts); i++) {
+      if (returns_part_of(dyn_ast_get(stmts, i), name))
+        return true;
+    }
+    return false;
+  }
+  case A_IF:
+    return returns_part_of(node->as.ifstmt->ifstmt, name) ||
+           returns_part_of(node->as.ifstmt->elsestmt, name);
+  case A_WHILE:
+    return returns_part_of(node->as.whilestmt->stmt, name);
+  case A_LOOP:
+    return returns_part_of(node->as.loop->stmt, name);
+  case A_ITER:
+    return returns_part_of(node->as.iter->stmt, name);
+  default:
+    return false;
+  }
+}
+
+static unsigned long long compute_aliased_params(ast_t fundef) {
+  ast_fundef_t f = *fundef->as.fundef;
+  unsigned long long res = 0;
+  for (size_t i = 0; i < ul_dyn_length(f.params) && i < MAX_SUMMARY_PARAMS;
+       i++) {
+    const char *name = dyn_ast_get(f.params, i)->as.fundef_param->name;
+    for (size_t j = 0; j < ul_dyn_length(f.body); j++) {
+      if (returns_part_of(dyn_ast_get(f.body, j), name)) {
+        res |= 1ULL << i;
+        break;
+      }
+    }
+  }
+  return res;
+}
+
+static unsigned long long compute_escaping_params(ast_t fundef) {
+  ast_fundef_t f = *fundef->as.fundef;
+  unsigned long long res = 0;
+  for (size_t i = 0; i < ul_dyn_length(f.params); i++) {
+    ast_t param = dyn_ast_get(f.params, i);
+    if (i >= MAX_SUMMARY_PARAMS)
+      break;
+    if (leaks_array(f.body, param->as.fundef_param->name))
+      res |= 1ULL << i;
+  }
+  return res;
+}
+
+void analyse_escapes(ast_t prog) {
+  escape_summaries = new_escape_dyn();
+  ast_array_t contents = prog->as.prog->prog;
+  for (size_t i = 0; i < ul_dyn_length(contents); i++) {
+    ast_t stmt = dyn_ast_get(contents, i);
+    if (stmt->kind == A_FUNDEF) {
+      escape_summary_t s = {.fundef = stmt, .method = NULL};
+      ul_dyn_append(&escape_summaries, s);
+    } else if (stmt->kind == A_TDEF &&
+               stmt->as.tdef->type.kind == TY_STRUCT) {
+      type_t t = stmt->as.tdef->type;
+      for (size_t m = 0; m < ul_dyn_length(t.methods); m++) {
+        ast_t fdef = dyn_ast_get(t.methods, m);
+        // mangled as __internal_<type>_<method>
+        const char *method =
+            fdef->as.fundef->name + strlen("__internal_") + strlen(t.name) + 1;
+        escape_summary_t s = {.fundef = fdef, .method = method};
+        ul_dyn_append(&escape_summaries, s);
+      }
+    }
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 0; i < ul_dyn_length(escape_summaries); i++) {
+      escape_summary_t *s =
+          ul_dyn_get_ptr(escape_summaries, i, escape_summary_t *);
+      unsigned long long escaping = compute_escaping_params(s->fundef);
+      unsigned long long aliased = compute_aliased_params(s->fundef);
+      if (escaping != s->escaping_params || aliased != s->aliased_params) {
+        s->escaping_params = escaping;
+        s->aliased_params = aliased;
+        changed = true;
+      }
+    }
+  }
+}
+
+bool var_escapes(ast_t fundef, const char *name) {
+  return leaks_array(fundef->as.fundef->body, name);
+}
@@ -0,0 +1,571 @@
+// FOLD SOURCE FILE
+// Paul Passeron
+
+// Constant folding and propagation for the generator.
+// Integer expressions made of literals and of top level variables that are
+// never assigned are evaluated here, following the C rules (promotion to int,
+// usual arithmetic conversions) since the generated code would have been
+// evaluated by the C compiler otherwise. Expressions whose value C leaves
+// undefined (signed overflow, division by zero) are left as they are.
+// '+' on strings made of literals is folded into one C string literal.
+// Calls to comptime functions with constant arguments are folded as well,
+// see comptime.c.
+
+#include "../include/fold.h"
+#include "../include/comptime.h"
+#include "../include/generator.h"
+#include "../include/ul_compiler_globals.h"
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// top level vardefs that are never assigned
+static ast_array_t candidates;
+static fold_constant_array_t constants;
+// results of the calls to comptime functions folded so far, the fold_index
+// of a call being the index of its result + 1
+static __internal_dyn_array_t folded_calls;
+
+static const struct {
+  const char *name;
+  int width;
+  bool is_signed;
+} int_types[] = {
+    {"i8", 8, true},    {"u8", 8, false},   {"i16", 16, true},
+    {"u16", 16, false}, {"i32", 32, true},  {"u32", 32, false},
+    {"i64", 64, true},  {"u64", 64, false}, {"char", 8, true},
+    {"bool", 8, false},
+};
+
+static bool find_int_type(const char *name, int *width, bool *is_signed) {
+  for (size_t i = 0; i < sizeof(int_types) / sizeof(*int_types); i++) {
+    if (streq(name, int_types[i].name)) {
+      *width = int_types[i].width;
+      *is_signed = int_types[i].is_signed;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool assigns_global(ast_t node, const char *name);
+
+static bool block_assigns_global(ast_array_t stmts, const char *name) {
+  for (size_t i = 0; i < ul_dyn_length(stmts); i++) {
+    ast_t stmt = dyn_ast_get(stmts, i);
+    // the rest of the block uses the local variable
+    if (stmt->kind == A_VARDEF && streq(stmt->as.vardef->name, name))
+      return false;
+    if (assigns_global(stmt, name))
+      return true;
+  }
+  return false;
+}
+
+// returns whether node may assign the top level variable called name, the
+// variables of the same name declared in node shadowing it
+static bool assigns_global(ast_t node, const char *name) {
+  if (node == NULL)
+    return false;
+  switch (node->kind) {
+  case A_ASSIGN: {
+    ast_t target = node->as.assign->expr;
+    return target->kind == A_IDEN && streq(target->as.iden->content, name);
+  }
+  case A_COMPOUND:
+    return block_assigns_global(node->as.compound->stmts, name);
+  case A_IF:
+    return assigns_global(node->as.ifstmt->ifstmt, name) ||
+           assigns_global(node->as.ifstmt->elsestmt, name);
+  case A_WHILE:
+    return assigns_global(node->as.whilestmt->stmt, name);
+  case A_LOOP:
+    return !streq(node->as.loop->varname, name) &&
+           assigns_global(node->as.loop->stmt, name);
+  case A_ITER:
+    return !streq(node->as.iter->var->as.iden->content, name) &&
+           assigns_global(node->as.iter->stmt, name);
+  default:
+    return false;
+  }
+}
+
+static bool function_assigns_global(ast_t fundef, const char *name) {
+  ast_fundef_t f = *fundef->as.fundef;
+  for (size_t i = 0; i < ul_dyn_length(f.params); i++) {
+    if (streq(dyn_ast_get(f.params, i)->as.fundef_param->name, name))
+      return false;
+  }
+  return block_assigns_global(f.body, name);
+}
+
+static bool is_assigned(ast_t prog, ast_t vardef) {
+  const char *name = vardef->as.vardef->name;
+  ast_array_t contents = prog->as.prog->prog;
+  for (size_t i = 0; i < ul_dyn_length(contents); i++) {
+    ast_t stmt = dyn_ast_get(contents, i);
+    if (stmt->kind == A_FUNDEF) {
+      if (function_assigns_global(stmt, name))
+        return true;
+    } else if (stmt->kind == A_TDEF &&
+               stmt->as.tdef->type.kind == TY_STRUCT) {
+      ast_array_t methods = stmt->as.tdef->type.methods;
+      for (size_t m = 0; m < ul_dyn_length(methods); m++) {
+        if (function_assigns_global(dyn_ast_get(methods, m), name))
+          return true;
+      }
+    } else if (stmt != vardef && assigns_global(stmt, name)) {
+      return true;
+    } else if (stmt != vardef && stmt->kind == A_VARDEF &&
+               streq(stmt->as.vardef->name, name)) {
+      // defined twice
+      return true;
+    }
+  }
+  return false;
+}
+
+void analyse_constants(ast_t prog) {
+  candidates = new_ast_dyn();
+  constants = new_fold_constant_dyn();
+  folded_calls = new_dyn(comptime_value_t, false);
+  ast_array_t contents = prog->as.prog->prog;
+  for (size_t i = 0; i < ul_dyn_length(contents); i++) {
+    ast_t stmt = dyn_ast_get(contents, i);
+    if (stmt->kind != A_VARDEF || stmt->as.vardef->value == NULL)
+      continue;
+    ast_type_t t = *stmt->as.vardef->type->as.type;
+    int width;
+    bool is_signed;
+    if (t.list_n > 0 || !find_int_type(t.name, &width, &is_signed))
+      continue;
+    if (!is_assigned(prog, stmt))
+      ul_dyn_append(&candidates, stmt);
+  }
+}
+
+// value of bits as an integer of the given width and signedness
+static fold_int_t new_int(unsigned long long bits, int width, bool is_signed) {
+  if (width < 64) {
+    unsigned long long mask = (1ULL << width) - 1;
+    bits &= mask;
+    if (is_signed && (bits >> (width - 1)) & 1)
+      bits |= ~mask;
+  }
+  return (fold_int_t){.bits = bits, .width = width, .is_signed = is_signed};
+}
+
+bool fold_to_type(fold_int_t v, const char *type, fold_int_t *res) {
+  int width;
+  bool is_signed;
+  if (!find_int_type(type, &width, &is_signed))
+    return false;
+  // bool keeps whether the value is zero, not its low bits
+  if (streq(type, "bool"))
+    v.bits = v.bits != 0;
+  *res = new_int(v.bits, width, is_signed);
+  return true;
+}
+
+// integer promotion: everything narrower than an int becomes an int
+static fold_int_t promote(fold_int_t v) {
+  if (v.width < 32)
+    return new_int(v.bits, 32, true);
+  return v;
+}
+
+// usual arithmetic conversions of promoted operands
+static void common_type(fold_int_t a, fold_int_t b, int *width,
+                        bool *is_signed) {
+  if (a.is_signed == b.is_signed) {
+    *width = a.width > b.width ? a.width : b.width;
+    *is_signed = a.is_signed;
+  } else {
+    fold_int_t u = a.is_signed ? b : a;
+    fold_int_t s = a.is_signed ? a : b;
+    if (u.width >= s.width) {
+      *width = u.width;
+      *is_signed = false;
+    } else {
+      *width = s.width;
+      *is_signed = true;
+    }
+  }
+}
+
+static bool in_range(long long v, int width) {
+  if (width == 64)
+    return true;
+  return v >= -(1LL << (width - 1)) && v < (1LL << (width - 1));
+}
+
+static bool fold_signed(token_kind_t op, long long a, long long b, int width,
+                        long long *res) {
+  bool overflow = false;
+  switch (op) {
+  case T_PLUS:
+    overflow = __builtin_add_overflow(a, b, res);
+    break;
+  case T_MINUS:
+    overflow = __builtin_sub_overflow(a, b, res);
+    break;
+  case T_MULT:
+    overflow = __builtin_mul_overflow(a, b, res);
+    break;
+  case T_DIV:
+  case T_MODULO: {
+    long long min = width == 64 ? LLONG_MIN : INT_MIN;
+    if (b == 0 || (a == min && b == -1))
+      return false;
+    *res = op == T_DIV ? a / b : a % b;
+  } break;
+  case T_LOG_AND:
+    *res = a & b;
+    break;
+  case T_LOG_OR:
+    *res = a | b;
+    break;
+  default:
+    return false;
+  }
+  return !overflow && in_range(*res, width);
+}
+
+static bool fold_unsigned(token_kind_t op, unsigned long long a,
+                          unsigned long long b, unsigned long long *res) {
+  switch (op) {
+  case T_PLUS:
+    *res = a + b;
+    break;
+  case T_MINUS:
+    *res = a - b;
+    break;
+  case T_MULT:
+    *res = a * b;
+    break;
+  case T_DIV:
+  case T_MODULO:
+    if (b == 0)
+      return false;
+    *res = op == T_DIV ? a / b : a % b;
+    break;
+  case T_LOG_AND:
+    *res = a & b;
+    break;
+  case T_LOG_OR:
+    *res = a | b;
+    break;
+  default:
+    return false;
+  }
+  return true;
+}
+
+static bool compare(token_kind_t op, fold_int_t a, fold_int_t b,
+                    bool is_signed, bool *res) {
+  long long sa = (long long)a.bits, sb = (long long)b.bits;
+  unsigned long long ua = a.bits, ub = b.bits;
+  switch (op) {
+  case T_GRTR:
+    *res = is_signed ? sa > sb : ua > ub;
+    return true;
+  case T_GRTR_EQ:
+    *res = is_signed ? sa >= sb : ua >= ub;
+    return true;
+  case T_LSSR:
+    *res = is_signed ? sa < sb : ua < ub;
+    return true;
+  case T_LSSR_EQ:
+    *res = is_signed ? sa <= sb : ua <= ub;
+    return true;
+  case T_EQ:
+    *res = ua == ub;
+    return true;
+  case T_DIFF:
+    *res = ua != ub;
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool fold_int_binop(token_kind_t op, fold_int_t a, fold_int_t b,
+                    fold_int_t *res) {
+  if (op == T_AND || op == T_OR) {
+    bool l = a.bits != 0, r = b.bits != 0;
+    *res = new_int(op == T_AND ? l && r : l || r, 32, true);
+    return true;
+  }
+  a = promote(a);
+  b = promote(b);
+  int width;
+  bool is_signed;
+  common_type(a, b, &width, &is_signed);
+  a = new_int(a.bits, width, is_signed);
+  b = new_int(b.bits, width, is_signed);
+  bool cmp;
+  if (compare(op, a, b, is_signed, &cmp)) {
+    *res = new_int(cmp, 32, true);
+    return true;
+  }
+  if (is_signed) {
+    long long r;
+    if (!fold_signed(op, (long long)a.bits, (long long)b.bits, width, &r))
+      return false;
+    *res = new_int((unsigned long long)r, width, true);
+  } else {
+    unsigned long long r;
+    if (!fold_unsigned(op, a.bits, b.bits, &r))
+      return false;
+    *res = new_int(r, width, false);
+  }
+  return true;
+}
+
+bool fold_int_unary(token_kind_t op, fold_int_t v, fold_int_t *res) {
+  v = promote(v);
+  switch (op) {
+  case T_PLUS:
+    *res = v;
+    return true;
+  case T_NOT:
+    *res = new_int(v.bits == 0, 32, true);
+    return true;
+  case T_MINUS:
+    if (v.is_signed) {
+      long long r;
+      if (__builtin_sub_overflow(0LL, (long long)v.bits, &r) ||
+          !in_range(r, v.width))
+        return false;
+      *res = new_int((unsigned long long)r, v.width, true);
+    } else {
+      *res = new_int(-v.bits, v.width, false);
+    }
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool append_text(fold_value_t *v, const char *text) {
+  size_t len = strlen(v->text);
+  if (len + strlen(text) + 2 > FOLD_TEXT_SIZE)
+    return false;
+  if (len > 0)
+    strcat(v->text, " ");
+  strcat(v->text, text);
+  return true;
+}
+
+// appends operand to the string literal v, as __UL_addstr would have
+static bool append_operand(fold_value_t *v, ast_t operand,
+                           fold_value_t value) {
+  if (value.kind == FOLD_STRING)
+    return append_text(v, value.text);
+  type_t t = get_type_of_expr(operand);
+  char buf[32];
+  if (streq(t.name, "char") && t.list_n == 0) {
+    unsigned char c = value.i.bits;
+    if (isprint(c) && c != '"' && c != '\\' && c != '?')
+      snprintf(buf, sizeof(buf), "\"%c\"", c);
+    else
+      snprintf(buf, sizeof(buf), "\"\\%03o\"", c);
+  } else if (is_int_type(t.name) && t.list_n == 0) {
+    // converted to the parameter of string_of_signed_int or
+    // string_of_unsigned_int
+    if (t.is_signed)
+      snprintf(buf, sizeof(buf), "\"%lld\"", (long long)value.i.bits);
+    else
+      snprintf(buf, sizeof(buf), "\"%llu\"", value.i.bits);
+  } else {
+    return false;
+  }
+  return append_text(v, buf);
+}
+
+static bool fold_binop(ast_t expr, fold_value_t *res) {
+  ast_binop_t b = *expr->as.binop;
+  fold_value_t l, r;
+  if (!fold_expression(b.left, &l) || !fold_expression(b.right, &r))
+    return false;
+  if (l.kind == FOLD_INT && r.kind == FOLD_INT) {
+    res->kind = FOLD_INT;
+    return fold_int_binop(b.op, l.i, r.i, &res->i);
+  }
+  if (b.op != T_PLUS)
+    return false;
+  *res = (fold_value_t){0};
+  res->kind = FOLD_STRING;
+  return append_operand(res, b.left, l) && append_operand(res, b.right, r);
+}
+
+static bool fold_unary(ast_t expr, fold_value_t *res) {
+  ast_unary_t u = *expr->as.unary;
+  fold_value_t v;
+  if (u.is_postfix || !fold_expression(u.operand, &v) || v.kind != FOLD_INT)
+    return false;
+  res->kind = FOLD_INT;
+  return fold_int_unary(u.op, v.i, &res->i);
+}
+
+// decimal literals are ints when they fit, longs otherwise
+static bool fold_numlit(ast_num_lit_t n, fold_int_t *res) {
+  if (n.has_point || n.content[0] == 0)
+    return false;
+  for (const char *c = n.content; *c; c++) {
+    if (!isdigit((unsigned char)*c))
+      return false;
+  }
+  errno = 0;
+  unsigned long long v = strtoull(n.content, NULL, 10);
+  if (errno == ERANGE || v > LLONG_MAX)
+    return false;
+  *res = new_int(v, v > INT_MAX ? 64 : 32, true);
+  return true;
+}
+
+static bool fold_charlit(const char *c, fold_int_t *res) {
+  size_t len = strlen(c);
+  unsigned char v;
+  if (len == 3 && c[1] != '\\') {
+    v = c[1];
+  } else if (len == 4 && c[1] == '\\') {
+    switch (c[2]) {
+    case 'n':
+      v = '\n';
+      break;
+    case 't':
+      v = '\t';
+      break;
+    case 'r':
+      v = '\r';
+      break;
+    case '0':
+      v = 0;
+      break;
+    case '\\':
+    case '\'':
+    case '"':
+      v = c[2];
+      break;
+    default:
+      return false;
+    }
+  } else {
+    return false;
+  }
+  *res = new_int(v, 8, true);
+  return true;
+}
+
+bool fold_literal(ast_t lit, fold_int_t *res) {
+  if (lit->kind == A_NUMLIT)
+    return fold_numlit(*lit->as.numlit, res);
+  if (lit->kind == A_CHARLIT)
+    return fold_charlit(lit->as.charlit->content, res);
+  return false;
+}
+
+// the constant named by expr, if the innermost variable of that name is one
+static bool fold_iden(ast_t expr, fold_value_t *res) {
+  const char *name = expr->as.iden->content;
+  var_array_t vars = generator.context.vars;
+  res->kind = FOLD_INT;
+  for (int i = ul_dyn_length(vars) - 1; i >= 0; i--) {
+    if (!streq(dyn_var_get(vars, i).name, name))
+      continue;
+    for (size_t j = 0; j < ul_dyn_length(constants); j++) {
+      fold_constant_t c = dyn_fold_constant_get(constants, j);
+      if (c.var_index == (size_t)i && streq(c.name, name)) {
+        res->i = c.value;
+        return true;
+      }
+    }
+    return false;
+  }
+  return false;
+}
+
+bool find_constant(const char *name, fold_int_t *res) {
+  for (int i = ul_dyn_length(constants) - 1; i >= 0; i--) {
+    fold_constant_t c = dyn_fold_constant_get(constants, i);
+    if (streq(c.name, name)) {
+      *res = c.value;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool register_constant(ast_t vardef, fold_value_t *res) {
+  bool found = false;
+  for (size_t i = 0; i < ul_dyn_length(candidates); i++)
+    found = found || dyn_ast_get(candidates, i) == vardef;
+  fold_value_t v;
+  if (!found || !fold_expression(vardef->as.vardef->value, &v) ||
+      v.kind != FOLD_INT)
+    return false;
+  fold_constant_t c = {.name = vardef->as.vardef->name,
+                       .var_index = ul_dyn_length(generator.context.vars)};
+  fold_to_type(v.i, vardef->as.vardef->type->as.type->name, &c.value);
+  ul_dyn_append(&constants, c);
+  res->kind = FOLD_INT;
+  res->i = c.value;
+  return true;
+}
+
+// the result of a call to a comptime function, if it is an integer
+static bool fold_funcall(ast_t expr, fold_value_t *res) {
+  res->kind = FOLD_INT;
+  if (expr->fold_index > 0) {
+    comptime_value_t v =
+        ul_dyn_get(folded_calls, expr->fold_index - 1, comptime_value_t);
+    res->i = v.i;
+    return true;
+  }
+  comptime_value_t v;
+  if (!comptime_evaluate(expr, &v) || v.array != NULL || v.i.width == 0)
+    return false;
+  res->i = v.i;
+  ul_dyn_append(&folded_calls, v);
+  expr->fold_index = ul_dyn_length(folded_calls);
+  return true;
+}
+
+static bool fold_node(ast_t expr, fold_value_t *res) {
+  switch (expr->kind) {
+  case A_NUMLIT:
+  case A_CHARLIT:
+    res->kind = FOLD_INT;
+    return fold_literal(expr, &res->i);
+  case A_STRLIT:
+    *res = (fold_value_t){0};
+    res->kind = FOLD_STRING;
+    return append_text(res, expr->as.strlit->content);
+  case A_IDEN:
+    return fold_iden(expr, res);
+  case A_BINOP:
+    return fold_binop(expr, res);
+  case A_UNARY:
+    return fold_unary(expr, res);
+  case A_FUNCALL:
+    return fold_funcall(expr, res);
+  default:
+    return false;
+  }
+}
+
+// The generator tries to fold each subexpression of the expressions it could
+// not fold: the nodes that are not constant are remembered so that it stays
+// linear
+bool fold_expression(ast_t expr, fold_value_t *res) {
+  if (expr->fold_index < 0)
+    return false;
+  if (fold_node(expr, res))
+    return true;
+  expr->fold_index = -1;
+  return false;
+}
@@ -2,13 +2,21 @@
 // Paul Passeron
 
 #include "../include/generator.h"
+#include "../include/comptime.h"
+#include "../include/escape.h"
+#include "../include/fold.h"
+#include "../include/inline.h"
 #include "../include/logger.h"
+#include "../include/reach.h"
+#include "../include/region.h"
 #include "../include/ul_allocator.h"
 #include "../include/ul_assert.h"
 #include "../include/ul_compiler_globals.h"
 #include "../include/ul_flow.h"
 #include "../include/ul_io.h"
 #include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
 
 generator_t generator;
 ast_t program;
@@ -111,13 +119,76 @@ type_t ARR_TYPE = {.name = "__internal_array_t",
 
 str_array_t enums_names;
 
-void set_generator_target(const char *target) {
-  enums_names = new_str_dyn();
-  FILE *f = fopen(target, "w");
-  if (f == NULL) {
-    ul_logger_erro("Could not set generator to target...");
-    ul_exit(1);
+// Builtin methods of arrays that are specialised for their element type, see
+// __UL_DEFINE_ARRAY in the prologue
+static const char *array_methods[] = {"append", "get",     "set",  "swap",
+                                      "sort",   "sort_by", "slice"};
+// Builtin methods of slices, see __UL_DEFINE_ARRAY as well
+static const char *slice_methods[] = {"get", "set", "slice"};
+
+bool is_array_method(const char *name) {
+  for (size_t i = 0; i < sizeof(array_methods) / sizeof(char *); i++) {
+    if (streq(name, array_methods[i]))
+      return true;
   }
+  return false;
+}
+
+bool is_slice_method(const char *name) {
+  for (size_t i = 0; i < sizeof(slice_methods) / sizeof(char *); i++) {
+    if (streq(name, slice_methods[i]))
+      return true;
+  }
+  return false;
+}
+
+// returns whether index is a loop variable known to be in the bounds of the
+// array arr
+bool index_in_bounds(ast_t arr, ast_t index) {
+  if (arr->kind != A_IDEN || index->kind != A_IDEN)
+    return false;
+  for (size_t i = 0; i < ul_dyn_length(generator.in_bounds); i++) {
+    var_t v = dyn_var_get(generator.in_bounds, i);
+    if (streq(v.name, index->as.iden->content) &&
+        streq(v.type, arr->as.iden->content))
+      return true;
+  }
+  return false;
+}
+
+// C type of the elements of the array type t
+const char *array_elem_type(type_t *t) {
+  return t->list_n > 1 ? "__internal_array_t" : t->name;
+}
+
+// Builtin methods of maps, see __UL_DEFINE_MAP in the prologue
+static const char *map_methods[] = {"set", "get", "has", "remove", "length"};
+
+// returns whether t is a map[K, V] type, setting *map to its registered type
+bool is_map_type(type_t t, type_t *map) {
+  if (t.list_n > 0)
+    return false;
+  for (size_t i = 0; i < ul_dyn_length(generator.context.types); i++) {
+    type_t *m = ul_dyn_get_ptr(generator.context.types, i, type_t *);
+    if (m->kind == TY_MAP && streq(m->name, t.name)) {
+      if (map != NULL)
+        *map = *m;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *map_key_type(type_t *map) {
+  return dyn_str_get(map->members_types, 0);
+}
+
+const char *map_value_type(type_t *map) {
+  return dyn_str_get(map->members_types, 1);
+}
+
+static void init_generator(FILE *f) {
+  enums_names = new_str_dyn();
   generator.context.types = new_type_dyn();
   generator.context.vars = new_var_dyn();
   ul_dyn_append(&generator.context.types, CHAR_TYPE);
@@ -135,6 +206,36 @@ void set_generator_target(const char *target) {
   ul_dyn_append(&generator.context.types, ARR_TYPE);
   generator.target = f;
   generator.failed = false;
+  generator.regions = true;
+  generator.bounds_checked = true;
+  generator.alloc_stats = false;
+  generator.in_bounds = new_var_dyn();
+  generator.incremental = false;
+}
+
+void set_generator_target(const char *target) {
+  FILE *f = fopen(target, "w");
+  if (f == NULL) {
+    ul_logger_erro("Could not set generator to target...");
+    ul_exit(1);
+  }
+  init_generator(f);
+}
+
+void set_generator_incremental(const char *dir) {
+  set_incremental_dir(dir);
+  init_generator(NULL);
+  generator.incremental = true;
+}
+
+void set_generator_regions(bool enabled) { generator.regions = enabled; }
+
+void set_generator_bounds_checked(bool checked) {
+  generator.bounds_checked = checked;
+}
+
+void set_generator_alloc_stats(bool enabled) {
+  generator.alloc_stats = enabled;
 }
 
 type_t get_type_of_expr(ast_t expr);
@@ -145,6 +246,7 @@ type_t get_type_by_name(const char *name, bool *found) {
   for (size_t i = 0; i < ul_dyn_length(generator.context.types); i++) {
     type_t t = dyn_type_get(generator.context.types, i);
     t.list_n = 0;
+    t.is_slice = false;
     if (streq(t.name, name)) {
       if (found != NULL)
         *found = true;
@@ -221,7 +323,14 @@ type_t get_method_ret_type(char *name, char *method) {
     ast_fundef_t f = *(a->as.fundef);
 
     if (streq(actual_name, f.name)) {
-      type_t ret = get_type_by_name(f.return_type->as.type->name, NULL);
+      ast_type_t ty = *f.return_type->as.type;
+      type_t ret = get_type_by_name(ty.name, NULL);
+      if (ty.list_n > 0) {
+        ret.list_n = ty.list_n;
+        ret.is_slice = ty.is_slice;
+        ret.is_builtin = false;
+        ret.kind = TY_ARRAY;
+      }
       return ret;
     }
   }
@@ -238,6 +347,7 @@ type_t get_type_of_var(const char *name, bool *found_name, bool *found_type) {
       *found_name = true;
       res = get_type_by_name(v.type, found_type);
       res.list_n = v.list_n;
+      res.is_slice = v.is_slice;
       if (v.list_n > 0) {
         res.kind = TY_ARRAY;
       }
@@ -261,20 +371,38 @@ bool has_failed(void) { return generator.failed; }
 
 void generate_forward(ast_t prog);
 void generate_methods(ast_t prog);
+void generate_folded(fold_value_t v);
+void generate_folded_int(fold_int_t v);
 void generate_epilogue();
+void enter_group(ast_t fundef);
 
 bool type_has_constructor(char *name);
+bool type_has_method(char *name, char *method);
+void generate_parts(ast_t prog);
+void check_unreachable(ast_t prog);
 void generate_program(ast_t prog) {
   program = prog;
   ul_logger_info("Generating Program");
+  analyse_escapes(prog);
+  analyse_constants(prog);
+  analyse_comptime(prog);
+  analyse_inlining(prog);
+  analyse_reachability(prog);
+  if (generator.incremental) {
+    generate_parts(prog);
+    return;
+  }
   generate_prolog();
   generate_forward(prog);
+  analyse_regions(prog);
   ast_array_t contents = prog->as.prog->prog;
   for (size_t i = 0; i < ul_dyn_length(contents); i++) {
     ast_t stmt = dyn_ast_get(contents, i);
-    generate_statement(stmt);
+    if (is_reachable(stmt))
+      generate_statement(stmt);
   }
   generate_methods(prog);
+  check_unreachable(prog);
   generate_epilogue();
 }
 
@@ -290,7 +418,9 @@ void generate_type(ast_t type) {
     generator.failed = true;
   }
   if (type->kind != A_IDEN) {
-    if (type->as.type->list_n > 0) {
+    if (type->as.type->is_slice) {
+      gprintf("__ul_slice_t");
+    } else if (type->as.type->list_n > 0) {
       gprintf("__internal_array_t");
     } else {
       gprintf("%s", type->as.iden->content);
@@ -311,12 +441,22 @@ void generate_fundef_param(ast_t fundef_param) {
   strcpy(var.name, f.name);
   strcpy(var.type, f.type->as.type->name);
   var.list_n = f.type->as.type->list_n;
+  var.is_slice = f.type->as.type->is_slice;
   ul_dyn_append(vs, var);
 }
 
+// Only entry is called from outside of the generated code, see inline.c
+// The parts of an incremental build call the functions of each other
+void generate_linkage(ast_t fundef) {
+  if (generator.incremental || streq(fundef->as.fundef->name, "entry"))
+    return;
+  gprintf(is_inline_function(fundef) ? "static inline " : "static ");
+}
+
 void generate_fundef(ast_t fundef) {
   ul_logger_info("Generating Fundef");
   ast_fundef_t f = *fundef->as.fundef;
+  generate_linkage(fundef);
   generate_type(f.return_type);
   gprintf(" %s%s(", FUN_PREFIX, f.name);
   for (size_t i = 0; i < ul_dyn_length(f.params); ++i) {
@@ -327,18 +467,53 @@ void generate_fundef(ast_t fundef) {
     generate_fundef_param(param);
   }
   gprintf("){\n");
+  generator.current_fundef = fundef;
+  generator.function_region =
+      generator.regions && function_is_releasable(fundef);
+  if (generator.function_region)
+    gprintf("size_t __ul_region_fn = __UL_region_push();");
   for (size_t i = 0; i < ul_dyn_length(f.body); ++i) {
     ast_t stmt = dyn_ast_get(f.body, i);
     generate_statement(stmt);
     gprintf("\n");
   }
+  if (generator.function_region)
+    gprintf("__UL_region_pop(__ul_region_fn);");
+  generator.current_fundef = NULL;
+  generator.function_region = false;
   gprintf("}\n");
 }
 
+// With --alloc-stats, the arenas created by the runtime for the call
+// generated between begin_creation() and end_creation() are tagged with the
+// current function, see __UL_CREATED_BY in the prologue
+static bool tags_creations(void) {
+  return generator.alloc_stats && generator.current_fundef != NULL;
+}
+
+static void begin_creation(void) {
+  if (tags_creations())
+    gprintf("__UL_CREATED_BY(");
+}
+
+static void end_creation(void) {
+  if (tags_creations())
+    gprintf(")");
+}
+
+// the runtime builtins creating arenas
+static bool creates_arenas(const char *name) {
+  return streq(name, "alloc_buffer") || streq(name, "new_string") ||
+         streq(name, "char_to_string") || streq(name, "append_string");
+}
+
 void generate_funcall(ast_t funcall) {
   ul_logger_info("Generating Funcall");
 
   ast_funcall_t f = *funcall->as.funcall;
+  bool creation = creates_arenas(f.name);
+  if (creation)
+    begin_creation();
   gprintf("%s%s(", FUN_PREFIX, f.name);
   for (size_t i = 0; i < ul_dyn_length(f.args); ++i) {
     if (i > 0) {
@@ -348,6 +523,37 @@ void generate_funcall(ast_t funcall) {
     generate_expression(arg);
   }
   gprintf(")");
+  if (creation)
+    end_creation();
+}
+
+// The array computed at compile time for the top level vardef is emitted as
+// static data, it only gets an arena once it grows
+void generate_static_array(ast_t vardef, comptime_array_t *arr) {
+  ast_vardef_t v = *vardef->as.vardef;
+  const char *type = v.type->as.type->name;
+  gprintf("static %s __ul_static_%s[%zu] = {", type, v.name,
+          arr->length > 0 ? arr->length : 1);
+  for (size_t i = 0; i < arr->length; i++) {
+    fold_int_t elem = {.bits = arr->items[i], .width = 64};
+    fold_to_type(elem, type, &elem);
+    if (i > 0)
+      gprintf(",");
+    if (i % 16 == 0)
+      gprintf("\n");
+    generate_folded_int(elem);
+  }
+  gprintf("%s};\n", arr->length > 0 ? "" : "0");
+  gprintf("static struct __internal_array_t __ul_static_array_%s = "
+          "{.contents = __ul_static_%s, .capacity = %zu, .length = %zu, "
+          ".stride = sizeof(%s), .arena = __UL_STATIC_ARENA};\n",
+          v.name, v.name, arr->length, arr->length, type);
+  generate_type(v.type);
+  gprintf(" %s = &__ul_static_array_%s;", v.name, v.name);
+  var_t var = {.list_n = 1, .is_slice = false};
+  strcpy(var.name, v.name);
+  strcpy(var.type, type);
+  ul_dyn_append(&generator.context.vars, var);
 }
 
 void generate_vardef(ast_t vardef) {
@@ -363,17 +569,34 @@ void generate_vardef(ast_t vardef) {
       is_array = false;
     }
   }
+  comptime_value_t computed;
+  if (v.value != NULL && is_array && generator.current_fundef == NULL &&
+      v.type->as.type->list_n == 1 && comptime_evaluate(v.value, &computed) &&
+      computed.array != NULL) {
+    generate_static_array(vardef, computed.array);
+    return;
+  }
   if (v.value != NULL) {
+    // top level variables that are never assigned become C constants
+    fold_value_t folded;
+    bool constant = generator.current_fundef == NULL && !is_array &&
+                    register_constant(vardef, &folded);
+    if (constant)
+      gprintf("static const ");
     generate_type(v.type);
     gprintf(" %s", v.name);
     gprintf("=");
-    generate_expression(v.value);
+    if (constant)
+      generate_folded(folded);
+    else
+      generate_expression(v.value);
     gprintf(";");
     var_array_t *vs = &generator.context.vars;
     var_t var;
     strcpy(var.name, v.name);
     strcpy(var.type, v.type->as.iden->content);
-    var.list_n = 0;
+    var.list_n = is_array ? v.type->as.type->list_n : 0;
+    var.is_slice = is_array && v.type->as.type->is_slice;
     ul_dyn_append(vs, var);
   } else {
     if (is_array) {
@@ -382,16 +605,26 @@ void generate_vardef(ast_t vardef) {
       strcpy(var.name, v.name);
       strcpy(var.type, v.type->as.iden->content);
       var.list_n = v.type->as.type->list_n;
+      var.is_slice = v.type->as.type->is_slice;
       ul_dyn_append(vs, var);
       generate_type(v.type);
-      gprintf(" %s = __internal_new_array(", v.name);
+      if (var.is_slice) {
+        // a slice views the elements of something else: empty until then
+        gprintf(" %s = (__ul_slice_t){0};", v.name);
+        return;
+      }
+      gprintf(" %s = ", v.name);
+      begin_creation();
+      gprintf("__internal_new_array(");
       if (v.type->as.type->list_n > 1) {
-        gprintf("__internal_array_t");
+        gprintf("__internal_array_t, true");
       } else {
         gprintf("%s, %s", v.type->as.type->name,
                 is_int_type(v.type->as.type->name) ? "false" : "true");
       }
-      gprintf(");");
+      gprintf(")");
+      end_creation();
+      gprintf(";");
     } else {
       bool found;
       type_t t = get_type_by_name(v.type->as.iden->content, &found);
@@ -399,11 +632,28 @@ void generate_vardef(ast_t vardef) {
       var_array_t *vs = &generator.context.vars;
       var_t var;
       var.list_n = 0;
+      var.is_slice = false;
       strcpy(var.name, v.name);
       // var.type = f.type->as.iden->content;
       strcpy(var.type, v.type->as.iden->content);
       ul_dyn_append(vs, var);
-      if (!t.is_builtin && t.kind == TY_STRUCT) {
+      if (t.kind == TY_MAP) {
+        gprintf("%s %s = ", t.name, v.name);
+        begin_creation();
+        gprintf("%s_new()", t.name);
+        end_creation();
+        gprintf(";");
+      } else if (!t.is_builtin && t.kind == TY_STRUCT &&
+                 generator.current_fundef != NULL &&
+                 !var_escapes(generator.current_fundef, v.name)) {
+        // The struct does not outlive the function: no need for an arena
+        gprintf("struct __ul_internal_%s __ul_stack_%s = {0};", t.name, v.name);
+        generate_type(v.type);
+        gprintf(" %s = &__ul_stack_%s;", v.name, v.name);
+        if (type_has_constructor(t.name)) {
+          gprintf(FUN_PREFIX "__internal_%s_%s(%s);", t.name, t.name, v.name);
+        }
+      } else if (!t.is_builtin && t.kind == TY_STRUCT) {
         generate_type(v.type);
         gprintf(" %s;", v.name);
         gprintf("{");
@@ -491,9 +741,11 @@ void generate_expression_as_string(ast_t stmt) {
     generate_expression(stmt);
   else {
     if (streq(tname, "char")) {
+      begin_creation();
       gprintf("__UL_char_to_string(");
       generate_expression(stmt);
       gprintf(")");
+      end_creation();
     } else if (is_int_type(tname)) {
       gprintf("__UL_string_of_%s_int(", t.is_signed ? "signed" : "unsigned");
       generate_expression(stmt);
@@ -561,9 +813,37 @@ void generate_if(ast_t ifstmt) {
   }
 }
 
+// Return types of the runtime builtins, see the prologue and the epilogue
+static const struct {
+  const char *name;
+  const char *type;
+  bool is_slice; // the type is a slice of type
+} builtin_ret_types[] = {
+    {"alloc_buffer", "cstr", false},   {"mmap_file", "cstr", false},
+    {"find_byte", "i64", false},       {"find_bytes", "i64", false},
+    {"bytes_eq", "bool", false},       {"compare_bytes", "i32", false},
+    {"hash_bytes", "u64", false},      {"bwrite", "i64", false},
+    {"new_string", "string", false},   {"char_to_string", "string", false},
+    {"append_string", "string", false}, {"string_to_cstr", "cstr", false},
+    {"buffer_slice", "char", true},
+};
+
 type_t get_ret_type_of_funcall(ast_t expr) {
   //
   ast_funcall_t f = *expr->as.funcall;
+  for (size_t i = 0; i < sizeof(builtin_ret_types) / sizeof(*builtin_ret_types);
+       i++) {
+    if (streq(f.name, builtin_ret_types[i].name)) {
+      type_t t = get_type_by_name(builtin_ret_types[i].type, NULL);
+      if (builtin_ret_types[i].is_slice) {
+        t.list_n = 1;
+        t.is_slice = true;
+        t.is_builtin = false;
+        t.kind = TY_ARRAY;
+      }
+      return t;
+    }
+  }
   ast_prog_t p = *program->as.prog;
   for (size_t i = 0; i < p.prog.length; i++) {
     ast_t stmt = dyn_ast_get(p.prog, i);
@@ -574,6 +854,7 @@ type_t get_ret_type_of_funcall(ast_t expr) {
         type_t t = get_type_by_name(ty.name, NULL);
         if (ty.list_n > 0) {
           t.list_n = ty.list_n;
+          t.is_slice = ty.is_slice;
           t.is_builtin = false;
           t.kind = TY_ARRAY;
         }
@@ -602,12 +883,37 @@ type_t get_type_of_expr(ast_t expr) {
     // TODO: Big refactor lol
     ast_access_t a = *expr->as.access;
     type_t t = get_type_of_expr(a.object);
+    type_t map;
+    if (a.field->kind == A_FUNCALL && is_map_type(t, &map)) {
+      char *n = a.field->as.funcall->name;
+      if (streq(n, "get"))
+        return get_type_by_name(map_value_type(&map), NULL);
+      if (streq(n, "has") || streq(n, "remove"))
+        return BOOL_TYPE;
+      if (streq(n, "length"))
+        return U64_TYPE;
+      return VOID_TYPE;
+    }
     if (a.field->kind == A_FUNCALL) {
       char *n = a.field->as.funcall->name;
       if (t.kind == TY_ARRAY && (streq(n, "set"))) {
         return VOID_TYPE;
       } else if (t.kind == TY_ARRAY && (streq(n, "append"))) {
         return VOID_TYPE;
+      } else if (t.kind == TY_ARRAY && (streq(n, "swap"))) {
+        return VOID_TYPE;
+      } else if (t.kind == TY_ARRAY && (streq(n, "reserve"))) {
+        return VOID_TYPE;
+      } else if (t.kind == TY_ARRAY &&
+                 (streq(n, "sort") || streq(n, "sort_by"))) {
+        return VOID_TYPE;
+      } else if (t.kind == TY_ARRAY && t.list_n > 0 && (streq(n, "get"))) {
+        t.list_n -= 1;
+        t.is_slice = false;
+        return t;
+      } else if (t.kind == TY_ARRAY && (streq(n, "slice"))) {
+        t.is_slice = true;
+        return t;
       } else if (t.kind == TY_ARRAY && (streq(n, "length"))) {
         return U32_TYPE;
       } else {
@@ -620,12 +926,16 @@ type_t get_type_of_expr(ast_t expr) {
     break;
   }
   case A_BINOP: {
-    return get_type_of_expr(expr->as.binop->left);
+    return get_type_of_expr(expr->as.binop->first);
   } break;
   case A_INDEX: {
     type_t t = get_type_of_expr(expr->as.index->value);
+    type_t map;
+    if (is_map_type(t, &map))
+      return get_type_by_name(map_value_type(&map), NULL);
     if (t.list_n > 0) {
       t.list_n -= 1;
+      t.is_slice = false;
       return t;
     }
     if (streq(t.name, "cstr") || streq(t.name, "string")) {
@@ -659,9 +969,59 @@ void generate_access(ast_t access) {
     gprintf("->%s", a.field->as.iden->content);
   } else {
     ast_funcall_t f = *a.field->as.funcall;
-    gprintf(FUN_PREFIX "__internal_%s_%s(",
-            t.list_n > 0 || t.kind == TY_ARRAY ? "__internal_array_t" : t.name,
-            f.name);
+    if (is_map_type(t, NULL)) {
+      bool known = false;
+      for (size_t i = 0; i < sizeof(map_methods) / sizeof(char *); i++)
+        known = known || streq(f.name, map_methods[i]);
+      ul_assert_location(access->loc, known,
+                         "Maps only have the methods set(), get(), has(), "
+                         "remove() and length()");
+      gprintf("%s_%s(", t.name, f.name);
+    } else if (t.is_slice) {
+      if (streq(f.name, "length")) {
+        gprintf("(");
+        generate_expression(a.object);
+        gprintf(").length");
+        return;
+      }
+      ul_assert_location(access->loc, is_slice_method(f.name),
+                         "Slices only have the methods length(), get(), "
+                         "set() and slice()");
+      bool in_bounds = (streq(f.name, "get") || streq(f.name, "set")) &&
+                       index_in_bounds(a.object, dyn_ast_get(f.args, 0));
+      gprintf("__ul_slice_%s_%s%s(", array_elem_type(&t), f.name,
+              in_bounds ? "_unchecked" : "");
+    } else if (t.list_n > 0 && is_array_method(f.name)) {
+      bool in_bounds = false;
+      if (streq(f.name, "get") || streq(f.name, "set")) {
+        in_bounds = index_in_bounds(a.object, dyn_ast_get(f.args, 0));
+      } else if (streq(f.name, "swap")) {
+        in_bounds = index_in_bounds(a.object, dyn_ast_get(f.args, 0)) &&
+                    index_in_bounds(a.object, dyn_ast_get(f.args, 1));
+      } else if (streq(f.name, "sort")) {
+        ul_assert_location(access->loc,
+                           t.list_n == 1 && is_int_type(t.name),
+                           "sort() only orders arrays of integers, use "
+                           "sort_by() with a comparison function");
+      } else if (streq(f.name, "sort_by")) {
+        ast_t less = ul_dyn_length(f.args) == 1 ? dyn_ast_get(f.args, 0) : NULL;
+        ul_assert_location(access->loc, less != NULL && less->kind == A_IDEN,
+                           "sort_by() expects the name of a function");
+        // the comparison is passed as a function pointer
+        gprintf("__ul_array_%s_sort_by(" FUN_PREFIX "%s, ", array_elem_type(&t),
+                less->as.iden->content);
+        generate_expression(a.object);
+        gprintf(")");
+        return;
+      }
+      gprintf("__ul_array_%s_%s%s(", array_elem_type(&t), f.name,
+              in_bounds ? "_unchecked" : "");
+    } else {
+      gprintf(FUN_PREFIX "__internal_%s_%s(",
+              t.list_n > 0 || t.kind == TY_ARRAY ? "__internal_array_t"
+                                                 : t.name,
+              f.name);
+    }
     size_t i;
     for (i = 0; i < ul_dyn_length(f.args); ++i) {
       if (i > 0) {
@@ -681,7 +1041,13 @@ void generate_access(ast_t access) {
 void generate_index(ast_t index) {
   ast_index_t i = *index->as.index;
   type_t t = get_type_of_expr(i.value);
-  if (streq(t.name, "string") && t.list_n == 0) {
+  if (is_map_type(t, NULL)) {
+    gprintf("%s_get(", t.name);
+    generate_expression(i.index);
+    gprintf(", ");
+    generate_expression(i.value);
+    gprintf(")");
+  } else if (streq(t.name, "string") && t.list_n == 0) {
     gprintf("(");
     generate_expression(i.value);
     gprintf(")->contents[");
@@ -693,11 +1059,12 @@ void generate_index(ast_t index) {
     generate_expression(i.index);
     gprintf("]");
   } else if (t.list_n > 0) {
-    gprintf(FUN_PREFIX "__internal___internal_array_t_get(");
+    gprintf("__ul_%s_%s_get%s(", t.is_slice ? "slice" : "array",
+            array_elem_type(&t),
+            index_in_bounds(i.value, i.index) ? "_unchecked" : "");
     generate_expression(i.index);
     gprintf(", ");
     generate_expression(i.value);
-    gprintf(", %s", t.list_n > 1 ? "__internal_array_t" : t.name);
     gprintf(")");
   }
 }
@@ -718,11 +1085,46 @@ void generate_unary(ast_t unary) {
   }
 }
 
+// emits the literal of a folded integer, with the type C would give it
+// integers narrower than int are emitted as int, as C promotes them
+void generate_folded_int(fold_int_t v) {
+  long long n = (long long)v.bits;
+  if (!v.is_signed && v.width >= 32)
+    gprintf("%llu%s", v.bits, v.width == 64 ? "UL" : "U");
+  else if (v.width == 64 && n == LLONG_MIN)
+    gprintf("(-9223372036854775807L-1)");
+  else if (v.width == 32 && n == INT_MIN)
+    gprintf("(-2147483647-1)");
+  else if (n < 0)
+    gprintf("(%lld%s)", n, v.width == 64 ? "L" : "");
+  else
+    gprintf("%lld%s", n, v.width == 64 ? "L" : "");
+}
+
+void generate_folded(fold_value_t v) {
+  if (v.kind == FOLD_STRING) {
+    begin_creation();
+    gprintf("__internal_cstr_to_string(%s)", v.text);
+    end_creation();
+  } else
+    generate_folded_int(v.i);
+}
+
 void generate_expression(ast_t stmt) {
   ul_logger_info("Generating Expression");
+  if (stmt->kind == A_BINOP || stmt->kind == A_UNARY ||
+      stmt->kind == A_IDEN || is_comptime_call(stmt)) {
+    fold_value_t v;
+    if (fold_expression(stmt, &v)) {
+      generate_folded(v);
+      return;
+    }
+  }
   switch (stmt->kind) {
   case A_STRLIT: {
+    begin_creation();
     gprintf("__internal_cstr_to_string(%s)", stmt->as.strlit->content);
+    end_creation();
     return;
   }
   case A_FUNCALL: {
@@ -766,7 +1168,88 @@ void generate_expression(ast_t stmt) {
                      "This kind of expression is not implemented yet");
 }
 
+// returns whether node may assign or declare a variable called name
+bool rebinds(ast_t node, const char *name) {
+  if (node == NULL)
+    return false;
+  switch (node->kind) {
+  case A_ASSIGN: {
+    ast_t target = node->as.assign->expr;
+    return target->kind == A_IDEN && streq(target->as.iden->content, name);
+  }
+  case A_VARDEF:
+    return streq(node->as.vardef->name, name);
+  case A_COMPOUND: {
+    ast_array_t stmts = node->as.compound->stmts;
+    for (size_t i = 0; i < ul_dyn_length(stmts); i++) {
+      if (rebinds(dyn_ast_get(stmts, i), name))
+        return true;
+    }
+    return false;
+  }
+  case A_IF:
+    return rebinds(node->as.ifstmt->ifstmt, name) ||
+           rebinds(node->as.ifstmt->elsestmt, name);
+  case A_WHILE:
+    return rebinds(node->as.whilestmt->stmt, name);
+  case A_LOOP:
+    return streq(node->as.loop->varname, name) ||
+           rebinds(node->as.loop->stmt, name);
+  case A_ITER:
+    return streq(node->as.iter->var->as.iden->content, name) ||
+           rebinds(node->as.iter->stmt, name);
+  default:
+    return false;
+  }
+}
+
+// Arrays never shrink, so the variable of 'loop i: a -> arr.length()' stays in
+// the bounds of arr when the start a is 0 or j + 1 with j itself in bounds,
+// as long as neither i nor arr are rebound in the body
+// returns the array the variable indexes, NULL if there is none
+ast_t loop_indexed_array(ast_loop_t l) {
+  if (!l.strict || l.end->kind != A_ACCESS)
+    return NULL;
+  ast_access_t end = *l.end->as.access;
+  if (end.object->kind != A_IDEN || end.field->kind != A_FUNCALL ||
+      !streq(end.field->as.funcall->name, "length"))
+    return NULL;
+  type_t t = get_type_of_expr(end.object);
+  if (t.list_n == 0)
+    return NULL;
+  bool from_zero = l.init->kind == A_NUMLIT &&
+                   streq(l.init->as.numlit->content, "0");
+  bool from_next = false;
+  if (l.init->kind == A_BINOP) {
+    ast_binop_t b = *l.init->as.binop;
+    from_next = b.op == T_PLUS && b.right->kind == A_NUMLIT &&
+                streq(b.right->as.numlit->content, "1") &&
+                index_in_bounds(end.object, b.left);
+  }
+  if (!from_zero && !from_next)
+    return NULL;
+  if (rebinds(l.stmt, l.varname) ||
+      rebinds(l.stmt, end.object->as.iden->content))
+    return NULL;
+  return end.object;
+}
+
 unsigned int loops_n = 0;
+unsigned int regions_n = 0;
+
+// The arenas created by an iteration are released at its end when none of
+// them can be reached from the next ones
+void generate_loop_body(ast_t stmt) {
+  if (!generator.regions || !scope_is_releasable(stmt)) {
+    generate_statement(stmt);
+    return;
+  }
+  regions_n++;
+  gprintf("{size_t __ul_region%d = __UL_region_push();", regions_n);
+  generate_statement(stmt);
+  gprintf("__UL_region_pop(__ul_region%d);}", regions_n);
+  regions_n--;
+}
 
 void generate_loop(ast_t loop) {
   loops_n++;
@@ -776,6 +1259,7 @@ void generate_loop(ast_t loop) {
   strcpy(var.name, l.varname);
   strcpy(var.type, "i32");
   var.list_n = 0;
+  var.is_slice = false;
   ul_dyn_append(&generator.context.vars, var);
 
   gprintf("{");
@@ -798,7 +1282,16 @@ void generate_loop(ast_t loop) {
           l.varname, loops_n, loops_n, l.varname,
           l.strict ? "<" : "<=", loops_n, loops_n, l.varname, loops_n);
 
-  generate_statement(l.stmt);
+  ast_t arr = loop_indexed_array(l);
+  if (arr != NULL) {
+    var_t in_bounds = {0};
+    strcpy(in_bounds.name, l.varname);
+    strcpy(in_bounds.type, arr->as.iden->content);
+    ul_dyn_append(&generator.in_bounds, in_bounds);
+  }
+  generate_loop_body(l.stmt);
+  if (arr != NULL)
+    ul_dyn_destroy_last(&generator.in_bounds);
   gprintf("}");
 
   loops_n--;
@@ -815,6 +1308,15 @@ void generate_compound(ast_t compound) {
 
 void generate_return(ast_t ret) {
   ast_return_t r = *ret->as.retstmt;
+  if (generator.function_region) {
+    // the value is computed before the arenas of the function are released
+    gprintf("{");
+    generate_type(generator.current_fundef->as.fundef->return_type);
+    gprintf(" __ul_ret = ");
+    generate_expression(r.expr);
+    gprintf(";__UL_region_pop(__ul_region_fn);return __ul_ret;}");
+    return;
+  }
   gprintf("return ");
   generate_expression(r.expr);
   gprintf(";");
@@ -838,26 +1340,28 @@ void generate_tdef(ast_t tdef) {
   gprintf("} __ul_internal_%s;", t.type.name);
 }
 
-bool type_has_constructor(char *name) {
+bool type_has_method(char *name, char *method) {
   bool found;
   type_t t = get_type_by_name(name, &found);
-  char constructor[128] = {0};
-  strcat(constructor, "__internal_");
-  strcat(constructor, name);
-  strcat(constructor, "_");
-  strcat(constructor, name);
+  char actual_name[128] = {0};
+  strcat(actual_name, "__internal_");
+  strcat(actual_name, name);
+  strcat(actual_name, "_");
+  strcat(actual_name, method);
   if (!found)
     return false;
   for (size_t i = 0; i < ul_dyn_length(t.methods); i++) {
     ast_t meth = dyn_ast_get(t.methods, i);
     ast_fundef_t m = *meth->as.fundef;
-    if (streq(m.name, constructor)) {
+    if (streq(m.name, actual_name)) {
       return true;
     }
   }
   return false;
 }
 
+bool type_has_constructor(char *name) { return type_has_method(name, name); }
+
 void generate_assign(ast_t assign) {
   ast_assign_t a = *assign->as.assign;
   generate_expression(a.expr);
@@ -871,44 +1375,99 @@ void generate_while(ast_t stmt) {
   gprintf("while(");
   generate_expression(w.condition);
   gprintf(")");
-  generate_statement(w.stmt);
+  generate_loop_body(w.stmt);
 }
 int iter_index = 0;
 
-void generate_iter(ast_t iter) {
+// iter over a struct value: the struct is an iterator if it has the methods
+// next(): bool, that advances it, and get(), that returns the current element
+void generate_iter_struct(ast_t iter, type_t t) {
   ast_iter_t i = *iter->as.iter;
-  gprintf("{__internal_array_t __internal_arr%d = ", iter_index);
+  type_t elem = get_method_ret_type(t.name, "get");
+  gprintf("{%s __internal_it%d = ", t.name, iter_index);
   generate_expression(i.itered);
   gprintf(";");
-  gprintf("for(size_t __internal_index%d=0; __internal_index%d< " FUN_PREFIX
-          "__internal___internal_array_t_length(__internal_arr%d); "
-          "__internal_index%d++){",
+  gprintf("while(" FUN_PREFIX "__internal_%s_next(__internal_it%d)){", t.name,
+          iter_index);
+  gprintf("%s %s = " FUN_PREFIX "__internal_%s_get(__internal_it%d);",
+          elem.name, i.var->as.iden->content, t.name, iter_index);
+  var_t v;
+  strcpy(v.name, i.var->as.iden->content);
+  strcpy(v.type, elem.name);
+  v.list_n = 0;
+  v.is_slice = false;
+  ul_dyn_append(&generator.context.vars, v);
+
+  iter_index++;
+  generate_loop_body(i.stmt);
+  gprintf("}}");
+  iter_index--;
+}
+
+// iter over a map visits its keys, in no particular order
+void generate_iter_map(ast_t iter, type_t map) {
+  ast_iter_t i = *iter->as.iter;
+  gprintf("{%s __internal_map%d = ", map.name, iter_index);
+  generate_expression(i.itered);
+  gprintf(";");
+  gprintf("for(size_t __internal_index%d=0; __internal_index%d< "
+          "__internal_map%d->capacity; __internal_index%d++){",
           iter_index, iter_index, iter_index, iter_index);
-  type_t t = get_type_of_expr(i.itered);
-  if (t.list_n > 1) {
-    gprintf("__internal_array_t ");
-  } else {
-    gprintf("%s ", t.name);
-  }
-  gprintf("%s = " FUN_PREFIX
-          "__internal___internal_array_t_get(__internal_index%d, "
-          "__internal_arr%d, ",
-          i.var->as.iden->content, iter_index, iter_index);
-  if (t.list_n > 1) {
-    gprintf("__internal_array_t ");
-  } else {
-    gprintf("%s ", t.name);
+  gprintf("if(__internal_map%d->ctrl[__internal_index%d] < 0) continue;",
+          iter_index, iter_index);
+  gprintf("%s %s = __internal_map%d->keys[__internal_index%d];",
+          map_key_type(&map), i.var->as.iden->content, iter_index, iter_index);
+  var_t v;
+  strcpy(v.name, i.var->as.iden->content);
+  strcpy(v.type, map_key_type(&map));
+  v.list_n = 0;
+  v.is_slice = false;
+  ul_dyn_append(&generator.context.vars, v);
+
+  iter_index++;
+  generate_loop_body(i.stmt);
+  gprintf("}}");
+  iter_index--;
+}
+
+void generate_iter(ast_t iter) {
+  ast_iter_t i = *iter->as.iter;
+  type_t itered_type = get_type_of_expr(i.itered);
+  if (itered_type.kind == TY_STRUCT && itered_type.list_n == 0 &&
+      type_has_method(itered_type.name, "next")) {
+    generate_iter_struct(iter, itered_type);
+    return;
+  }
+  type_t map;
+  if (is_map_type(itered_type, &map)) {
+    generate_iter_map(iter, map);
+    return;
   }
-  gprintf(");");
+  type_t t = get_type_of_expr(i.itered);
+  gprintf("{%s __internal_arr%d = ",
+          t.is_slice ? "__ul_slice_t" : "__internal_array_t", iter_index);
+  generate_expression(i.itered);
+  gprintf(";");
+  gprintf("for(size_t __internal_index%d=0; __internal_index%d< "
+          "__internal_arr%d%slength; "
+          "__internal_index%d++){",
+          iter_index, iter_index, iter_index, t.is_slice ? "." : "->",
+          iter_index);
+  gprintf("%s %s = __ul_%s_%s_get_unchecked(__internal_index%d, "
+          "__internal_arr%d);",
+          array_elem_type(&t), i.var->as.iden->content,
+          t.is_slice ? "slice" : "array", array_elem_type(&t), iter_index,
+          iter_index);
   var_t v;
 
   strcpy(v.name, i.var->as.iden->content);
   strcpy(v.type, t.name);
   v.list_n = t.list_n - 1;
+  v.is_slice = false;
   ul_dyn_append(&generator.context.vars, v);
 
   iter_index++;
-  generate_statement(i.stmt);
+  generate_loop_body(i.stmt);
   gprintf("}}");
   iter_index--;
 }
@@ -996,6 +1555,7 @@ void generate_fundef_prototype(ast_t stmt) {
     ast_fundef_t f = *stmt->as.fundef;
     if (streq(f.name, "entry"))
       return;
+    generate_linkage(stmt);
     generate_type(f.return_type);
     gprintf(" %s%s(", FUN_PREFIX, f.name);
     for (size_t k = 0; k < ul_dyn_length(f.params); ++k) {
@@ -1021,6 +1581,7 @@ void generate_enum(ast_t enumdef) {
     var_t v;
     strcpy(v.name, name);
     v.list_n = 0;
+    v.is_slice = false;
     strcpy(v.type, t.name);
     ul_dyn_append(&generator.context.vars, v);
   }
@@ -1028,6 +1589,27 @@ void generate_enum(ast_t enumdef) {
   ul_dyn_append(&generator.context.types, t);
 }
 
+// Registers the map[K, V] types used by the program, their methods being
+// defined by __UL_DEFINE_MAP once the types of their keys and values are
+void generate_map_types(ast_t prog) {
+  ast_array_t maps = prog->as.prog->map_types;
+  for (size_t i = 0; i < ul_dyn_length(maps); i++) {
+    ast_t node = dyn_ast_get(maps, i);
+    ast_type_t m = *node->as.type;
+    char *key = m.key->as.type->name;
+    char *value = m.value->as.type->name;
+    ul_assert_location(node->loc, is_int_type(key) || streq(key, "string"),
+                       "The keys of maps can only be integers or strings");
+    type_t t = {.kind = TY_MAP};
+    strcpy(t.name, m.name);
+    t.members_types = new_str_dyn();
+    ul_dyn_append(&t.members_types, key);
+    ul_dyn_append(&t.members_types, value);
+    ul_dyn_append(&generator.context.types, t);
+    gprintf("typedef struct %s *%s;", t.name, t.name);
+  }
+}
+
 void generate_forward(ast_t prog) {
   ul_logger_info("Generating Forward definitions");
   ast_array_t contents = prog->as.prog->prog;
@@ -1040,9 +1622,10 @@ void generate_forward(ast_t prog) {
       }
     }
   }
+  generate_map_types(prog);
   for (size_t i = 0; i < ul_dyn_length(contents); i++) {
     ast_t stmt = dyn_ast_get(contents, i);
-    if (stmt->kind == A_TDEF) {
+    if (stmt->kind == A_TDEF && is_reachable(stmt)) {
       ast_tdef_t t = *stmt->as.tdef;
       if (t.type.kind == TY_STRUCT) {
         ul_dyn_append(&generator.context.types, t.type);
@@ -1050,15 +1633,36 @@ void generate_forward(ast_t prog) {
                 t.type.name);
         for (size_t m = 0; m < ul_dyn_length(t.type.methods); m++) {
           ast_t fdef = dyn_ast_get(t.type.methods, m);
-          generate_fundef_prototype(fdef);
+          if (is_reachable(fdef))
+            generate_fundef_prototype(fdef);
         }
       }
     }
   }
 
+  // Every type may be the element type of an array
+  for (size_t i = 0; i < ul_dyn_length(generator.context.types); i++) {
+    type_t t = dyn_type_get(generator.context.types, i);
+    if (!streq(t.name, "void"))
+      gprintf("__UL_DEFINE_ARRAY(%s)\n", t.name);
+    if (is_int_type(t.name))
+      gprintf("__UL_DEFINE_ARRAY_SORT(%s)\n", t.name);
+  }
+
+  for (size_t i = 0; i < ul_dyn_length(generator.context.types); i++) {
+    type_t t = dyn_type_get(generator.context.types, i);
+    if (t.kind == TY_MAP) {
+      const char *key = map_key_type(&t);
+      gprintf("__UL_DEFINE_MAP(%s, %s, %s, %s)\n", t.name, key,
+              map_value_type(&t),
+              is_int_type((char *)key) ? "int" : "string");
+    }
+  }
+
   for (size_t i = 0; i < ul_dyn_length(contents); i++) {
     ast_t stmt = dyn_ast_get(contents, i);
-    generate_fundef_prototype(stmt);
+    if (is_reachable(stmt))
+      generate_fundef_prototype(stmt);
   }
 }
 
@@ -1074,7 +1678,10 @@ void generate_methods(ast_t prog) {
       for (size_t m = 0; m < ul_dyn_length(t.type.methods); m++) {
         size_t l = ul_dyn_length(generator.context.vars);
         ast_t fdef = dyn_ast_get(t.type.methods, m);
-        generate_fundef(fdef);
+        if (is_reachable(fdef)) {
+          enter_group(fdef);
+          generate_fundef(fdef);
+        }
         while (ul_dyn_length(generator.context.vars) > l) {
           ul_dyn_destroy_last(&generator.context.vars);
         }
@@ -1086,8 +1693,48 @@ void generate_methods(ast_t prog) {
   }
 }
 
+// The functions and methods that are not reachable are not emitted, but are
+// still generated, into a stream that is thrown away, so that their errors
+// are reported as for the rest of the program
+void check_unreachable(ast_t prog) {
+  FILE *target = generator.target;
+  char *text;
+  size_t length;
+  generator.target = open_memstream(&text, &length);
+  ast_array_t contents = prog->as.prog->prog;
+  for (size_t i = 0; i < ul_dyn_length(contents); i++) {
+    ast_t stmt = dyn_ast_get(contents, i);
+    if (stmt->kind == A_TDEF && stmt->as.tdef->type.kind == TY_STRUCT &&
+        !is_reachable(stmt))
+      ul_dyn_append(&generator.context.types, stmt->as.tdef->type);
+  }
+  for (size_t i = 0; i < ul_dyn_length(contents); i++) {
+    ast_t stmt = dyn_ast_get(contents, i);
+    if (stmt->kind == A_FUNDEF && !is_reachable(stmt))
+      generate_statement(stmt);
+    if (stmt->kind != A_TDEF)
+      continue;
+    type_t t = stmt->as.tdef->type;
+    for (size_t m = 0; m < ul_dyn_length(t.methods); m++) {
+      size_t l = ul_dyn_length(generator.context.vars);
+      ast_t fdef = dyn_ast_get(t.methods, m);
+      if (!is_reachable(fdef))
+        generate_fundef(fdef);
+      while (ul_dyn_length(generator.context.vars) > l)
+        ul_dyn_destroy_last(&generator.context.vars);
+    }
+  }
+  fclose(generator.target);
+  free(text);
+  generator.target = target;
+}
+
 void generate_prolog() {
   ul_logger_info("Generating Prolog");
+  if (!generator.bounds_checked)
+    gprintf("#define __UL_BOUNDS_UNCHECKED\n");
+  if (generator.alloc_stats)
+    gprintf("#define __UL_ALLOC_STATS\n");
   char *buff;
   FILE *f = fopen("src/template/prologue.c", "r");
   fseek(f, 0, SEEK_END);
@@ -1113,3 +1760,86 @@ void generate_epilogue() {
   set_arena(old_arena);
   gprintf("%s", buff);
 }
+
+// Functions are written in the part of their group, see starts_group()
+void enter_group(ast_t fundef) {
+  if (!generator.incremental)
+    return;
+  char *name = fundef->as.fundef->name;
+  if (generator.group.f == NULL || starts_group(name)) {
+    close_part(&generator.group);
+    char part[PART_NAME_MAX];
+    snprintf(part, sizeof(part), "f_%.*s.c", PART_NAME_MAX - 5, name);
+    generator.group = open_part(part);
+    fprintf(generator.group.f, "#include \"program.h\"\n");
+  }
+  generator.target = generator.group.f;
+}
+
+// Top level variables are defined in main.c and declared in program.h,
+// except for constants that every part needs the value of
+void generate_global(ast_t vardef, FILE *header, FILE *main) {
+  char *text;
+  size_t length;
+  generator.target = open_memstream(&text, &length);
+  generate_vardef(vardef);
+  fclose(generator.target);
+  ast_vardef_t v = *vardef->as.vardef;
+  fold_int_t value;
+  if (find_constant(v.name, &value)) {
+    fprintf(header, "%s\n", text);
+  } else {
+    fprintf(main, "%s\n", text);
+    generator.target = header;
+    gprintf("extern ");
+    generate_type(v.type);
+    gprintf(" %s;\n", v.name);
+  }
+  free(text);
+}
+
+// runtime.c defines the runtime, program.h declares it along with the types,
+// functions and variables of the program, main.c defines the variables and
+// the rest of the parts the functions
+void generate_parts(ast_t prog) {
+  part_t runtime = open_part("runtime.c");
+  generator.target = runtime.f;
+  generate_prolog();
+  close_part(&runtime);
+
+  part_t header = open_part("program.h");
+  part_t main = open_part("main.c");
+  generator.target = main.f;
+  gprintf("#include \"program.h\"\n");
+  generator.target = header.f;
+  gprintf("#ifndef __UL_PROGRAM_H\n#define __UL_PROGRAM_H\n"
+          "#define __UL_RUNTIME_DECLARATIONS\n");
+  generate_prolog();
+  generate_forward(prog);
+  analyse_regions(prog);
+  ast_array_t contents = prog->as.prog->prog;
+  for (size_t i = 0; i < ul_dyn_length(contents); i++) {
+    ast_t stmt = dyn_ast_get(contents, i);
+    if (!is_reachable(stmt))
+      continue;
+    if (stmt->kind == A_VARDEF) {
+      generate_global(stmt, header.f, main.f);
+      continue;
+    }
+    if (stmt->kind == A_FUNDEF)
+      enter_group(stmt);
+    else
+      generator.target = header.f;
+    generate_statement(stmt);
+  }
+  generate_methods(prog);
+  check_unreachable(prog);
+  close_part(&generator.group);
+  generator.target = header.f;
+  gprintf("\n#endif // __UL_PROGRAM_H\n");
+  close_part(&header);
+  generator.target = main.f;
+  generate_epilogue();
+  close_part(&main);
+  generator.target = NULL;
+}
@@ -0,0 +1,188 @@
+// INCREMENTAL SOURCE FILE
+// Paul Passeron
+
+// Incremental builds.
+// With --incremental the generator splits the program into parts: program.h
+// declares everything, main.c defines the top level variables and the
+// string runtime, runtime.c the rest of the runtime, and each group of
+// functions gets a file of its own. A part is only replaced when its
+// contents change, and a generated Makefile compiles the parts that changed
+// since the last build before linking them: editing the body of a function
+// only recompiles its group.
+
+#include "../include/incremental.h"
+#include "../include/cache.h"
+#include "../include/logger.h"
+#include "../include/ul_assert.h"
+#include "../include/ul_compiler_globals.h"
+#include "../include/ul_dyn_arrays.h"
+#include "../include/ul_flow.h"
+#include <dirent.h>
+#include <linux/limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PART_PATH_MAX (PATH_MAX + PART_NAME_MAX + 8)
+
+static char parts_dir[PATH_MAX];
+static str_array_t written_parts;
+
+static const char *parts_makefile =
+    "include flags.mk\n"
+    "include objects.mk\n"
+    "\n"
+    "$(OUTPUT): $(OBJECTS) objects.mk\n"
+    "\t/usr/bin/gcc $(CFLAGS) -o $@ $(OBJECTS)\n"
+    "\n"
+    "runtime.o: runtime.c flags.mk\n"
+    "\t/usr/bin/gcc $(CFLAGS) -c -o $@ runtime.c\n"
+    "\n"
+    "program.h.gch: program.h flags.mk\n"
+    "\t/usr/bin/gcc $(CFLAGS) -x c-header -o $@ program.h\n"
+    "\n"
+    "%.o: %.c program.h.gch flags.mk\n"
+    "\t/usr/bin/gcc $(CFLAGS) -c -o $@ $<\n";
+
+void set_incremental_dir(const char *dir) {
+  ul_assert(strlen(dir) < PATH_MAX, "The build directory is too long");
+  strcpy(parts_dir, dir);
+  if (mkdir(parts_dir, 0755) != 0 && access(parts_dir, W_OK) != 0) {
+    ul_logger_erro("Could not create the build directory");
+    ul_exit(1);
+  }
+  written_parts = new_str_dyn();
+}
+
+static void part_path(const char *name, const char *ext, char *res) {
+  snprintf(res, PART_PATH_MAX, "%s/%s%s", parts_dir, name, ext);
+}
+
+part_t open_part(const char *name) {
+  part_t res = {0};
+  ul_assert(strlen(name) < PART_NAME_MAX, "The name of a part is too long");
+  strcpy(res.name, name);
+  char path[PART_PATH_MAX];
+  part_path(name, ".tmp", path);
+  res.f = fopen(path, "w");
+  if (res.f == NULL) {
+    ul_logger_erro("Could not write in the build directory");
+    ul_exit(1);
+  }
+  return res;
+}
+
+static bool same_contents(const char *a, const char *b) {
+  FILE *fa = fopen(a, "r");
+  FILE *fb = fopen(b, "r");
+  bool res = fa != NULL && fb != NULL;
+  char ba[4096];
+  char bb[4096];
+  while (res) {
+    size_t na = fread(ba, 1, sizeof(ba), fa);
+    size_t nb = fread(bb, 1, sizeof(bb), fb);
+    res = na == nb && memcmp(ba, bb, na) == 0;
+    if (na == 0)
+      break;
+  }
+  if (fa != NULL)
+    fclose(fa);
+  if (fb != NULL)
+    fclose(fb);
+  return res;
+}
+
+void close_part(part_t *part) {
+  if (part->f == NULL)
+    return;
+  fclose(part->f);
+  part->f = NULL;
+  char tmp[PART_PATH_MAX];
+  char path[PART_PATH_MAX];
+  part_path(part->name, ".tmp", tmp);
+  part_path(part->name, "", path);
+  if (same_contents(tmp, path))
+    remove(tmp);
+  else
+    rename(tmp, path);
+  char *name = strdup(part->name);
+  ul_assert(name != NULL, "Could not allocate the name of a part");
+  ul_dyn_append(&written_parts, name);
+}
+
+bool starts_group(const char *name) {
+  return cache_hash(CACHE_HASH_SEED, name, strlen(name)) %
+             INCREMENTAL_GROUP_SPAN ==
+         0;
+}
+
+static bool was_written(const char *name) {
+  for (size_t i = 0; i < ul_dyn_length(written_parts); i++) {
+    if (streq(dyn_str_get(written_parts, i), name))
+      return true;
+  }
+  return false;
+}
+
+// removes the groups of functions, and their objects, that no longer exist
+static void remove_stale_parts(void) {
+  DIR *d = opendir(parts_dir);
+  if (d == NULL)
+    return;
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    size_t length = strlen(e->d_name);
+    if (strncmp(e->d_name, "f_", 2) != 0 || length < 3 ||
+        length >= PART_NAME_MAX || e->d_name[length - 2] != '.')
+      continue;
+    char source[PART_NAME_MAX];
+    strcpy(source, e->d_name);
+    source[length - 1] = 'c';
+    if (!was_written(source)) {
+      char path[PART_PATH_MAX];
+      part_path(e->d_name, "", path);
+      remove(path);
+    }
+  }
+  closedir(d);
+}
+
+bool build_parts(const char *output, const char *opt_level) {
+  remove_stale_parts();
+  char cwd[PATH_MAX] = {0};
+  if (output[0] != '/' && getcwd(cwd, sizeof(cwd)) == NULL) {
+    ul_logger_erro("Could not find the current directory");
+    return false;
+  }
+  size_t parts = ul_dyn_length(written_parts);
+
+  part_t flags = open_part("flags.mk");
+  fprintf(flags.f, "CFLAGS = %s\n", opt_level);
+  close_part(&flags);
+
+  part_t objects = open_part("objects.mk");
+  fprintf(objects.f, "OUTPUT = %s%s%s\nOBJECTS = runtime.o", cwd,
+          output[0] == '/' ? "" : "/", output);
+  for (size_t i = 0; i < parts; i++) {
+    char *name = dyn_str_get(written_parts, i);
+    size_t length = strlen(name);
+    if (length > 2 && streq(name + length - 2, ".c") &&
+        !streq(name, "runtime.c"))
+      fprintf(objects.f, " %.*s.o", (int)(length - 2), name);
+  }
+  fprintf(objects.f, "\n");
+  close_part(&objects);
+
+  part_t makefile = open_part("Makefile");
+  fprintf(makefile.f, "%s", parts_makefile);
+  close_part(&makefile);
+
+  char command[PATH_MAX + 64];
+  snprintf(command, sizeof(command), "make -s -C %s -j%ld", parts_dir,
+           sysconf(_SC_NPROCESSORS_ONLN));
+  char info[PATH_MAX + 80];
+  snprintf(info, sizeof(info), "[CMD] %s", command);
+  ul_logger_info(info);
+  return system(command) == 0;
+}
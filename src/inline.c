@@ -0,0 +1,116 @@
+// INLINE SOURCE FILE
+// Paul Passeron
+
+// Inlining hints for the C compiler.
+// Every function but entry is emitted with internal linkage, so that the C
+// compiler can inline it into its callers and drop it once it is not used.
+// Functions marked inline, and the small leaves of the call graph (functions
+// that only call runtime builtins), are emitted static inline as well.
+
+#include "../include/inline.h"
+#include "../include/ul_compiler_globals.h"
+#include <string.h>
+
+// names of the functions of the program, and of the methods without their
+// type as the type of a receiver is not known here
+static str_array_t program_functions;
+
+void analyse_inlining(ast_t prog) {
+  program_functions = new_str_dyn();
+  ast_array_t contents = prog->as.prog->prog;
+  for (size_t i = 0; i < ul_dyn_length(contents); i++) {
+    ast_t stmt = dyn_ast_get(contents, i);
+    if (stmt->kind == A_FUNDEF) {
+      ul_dyn_append(&program_functions, stmt->as.fundef->name);
+    } else if (stmt->kind == A_TDEF &&
+               stmt->as.tdef->type.kind == TY_STRUCT) {
+      type_t t = stmt->as.tdef->type;
+      for (size_t m = 0; m < ul_dyn_length(t.methods); m++) {
+        // mangled as __internal_<type>_<method>
+        char *name = dyn_ast_get(t.methods, m)->as.fundef->name +
+                     strlen("__internal_") + strlen(t.name) + 1;
+        ul_dyn_append(&program_functions, name);
+      }
+    }
+  }
+}
+
+static bool is_program_function(const char *name) {
+  for (size_t i = 0; i < ul_dyn_length(program_functions); i++) {
+    if (streq(dyn_str_get(program_functions, i), name))
+      return true;
+  }
+  return false;
+}
+
+// adds the number of nodes of node to *count, sets *calls if it calls a
+// function of the program
+static void measure(ast_t node, size_t *count, bool *calls);
+
+static void measure_array(ast_array_t nodes, size_t *count, bool *calls) {
+  for (size_t i = 0; i < ul_dyn_length(nodes); i++)
+    measure(dyn_ast_get(nodes, i), count, calls);
+}
+
+static void measure(ast_t node, size_t *count, bool *calls) {
+  if (node == NULL || *count > INLINE_MAX_NODES)
+    return;
+  (*count)++;
+  switch (node->kind) {
+  case A_FUNCALL:
+    *calls = *calls || is_program_function(node->as.funcall->name);
+    measure_array(node->as.funcall->args, count, calls);
+    break;
+  case A_BINOP:
+    measure(node->as.binop->left, count, calls);
+    measure(node->as.binop->right, count, calls);
+    break;
+  case A_UNARY:
+    measure(node->as.unary->operand, count, calls);
+    break;
+  case A_ACCESS:
+    measure(node->as.access->object, count, calls);
+    measure(node->as.access->field, count, calls);
+    break;
+  case A_INDEX:
+    measure(node->as.index->value, count, calls);
+    measure(node->as.index->index, count, calls);
+    break;
+  case A_ASSIGN:
+    measure(node->as.assign->expr, count, calls);
+    measure(node->as.assign->value, count, calls);
+    break;
+  case A_VARDEF:
+    measure(node->as.vardef->value, count, calls);
+    break;
+  case A_RETURN:
+    measure(node->as.retstmt->expr, count, calls);
+    break;
+  case A_COMPOUND:
+    measure_array(node->as.compound->stmts, count, calls);
+    break;
+  case A_IF:
+    measure(node->as.ifstmt->condition, count, calls);
+    measure(node->as.ifstmt->ifstmt, count, calls);
+    measure(node->as.ifstmt->elsestmt, count, calls);
+    break;
+  // loops are rarely worth inlining
+  case A_WHILE:
+  case A_LOOP:
+  case A_ITER:
+    *count = INLINE_MAX_NODES + 1;
+    break;
+  default:
+    break;
+  }
+}
+
+bool is_inline_function(ast_t fundef) {
+  ast_fundef_t f = *fundef->as.fundef;
+  if (f.is_inline)
+    return true;
+  size_t count = 0;
+  bool calls = false;
+  measure_array(f.body, &count, &calls);
+  return count <= INLINE_MAX_NODES && !calls;
+}
@@ -1,5 +1,7 @@
 #include "../include/lexer.h"
 #include "../include/logger.h"
+#include "../include/str_set.h"
+#include "../include/token_cache.h"
 #include "../include/ul_allocator.h"
 #include "../include/ul_assert.h"
 #include "../include/ul_compiler_globals.h"
@@ -10,7 +12,7 @@
 #include <stdlib.h>
 #include <string.h>
 
-extern str_array_t included_files;
+extern str_set_t included_files;
 extern unsigned int inc_arena;
 
 const char *lexer_state_to_str(lexer_state_t state) {
@@ -54,10 +56,15 @@ void new_lexer(lexer_t *l, char *path) {
   l->buffer_index = 0;
   l->state = LS_DEFAULT;
   l->toks = new_tok_dyn();
+  l->first_token = 0;
+  l->includes = new_lexer_include_dyn();
   set_arena(old_arena);
 }
 
-void destroy_lexer(lexer_t l) { destroy_arena(l.arena); }
+void destroy_lexer(lexer_t l) {
+  ul_dyn_destroy(l.includes);
+  destroy_arena(l.arena);
+}
 
 char consume_char(lexer_t *l) {
   if (is_end_of_file(*l))
@@ -341,6 +348,36 @@ bool step_delim(lexer_t *l) {
   return false;
 }
 
+// The tokens of an included file are lexed straight into the tokens of the
+// file including it, so that nested includes are never copied
+static void include_file(lexer_t *l, const char *name) {
+  char path[256] = {0};
+  char fn[256] = {0};
+  strcpy(fn, l->filename);
+  strcpy(path, dirname(fn));
+  strcat(path, "/");
+  strcat(path, name);
+  char rpath[PATH_MAX] = {0};
+  realpath(path, rpath);
+
+  unsigned int old_arena = get_arena();
+  set_arena(inc_arena);
+  lexer_include_t inc = {.name = alloc_preset_ptr(1, strlen(name) + 1,
+                                                  (char *)name),
+                         .index = ul_dyn_length(l->toks),
+                         .count = 0};
+  set_arena(old_arena);
+  if (!str_set_contains(included_files, rpath)) {
+    set_arena(inc_arena);
+    char *included = alloc_preset_ptr(1, strlen(rpath) + 1, rpath);
+    set_arena(old_arena);
+    str_set_insert(&included_files, included);
+    lex_file(&l->toks, path);
+    inc.count = ul_dyn_length(l->toks) - inc.index;
+  }
+  ul_dyn_append(&l->includes, inc);
+}
+
 bool step_include(lexer_t *l) {
   char buffer[128] = {0};
   if (!matches_string(*l, "\"")) {
@@ -354,38 +391,7 @@ bool step_include(lexer_t *l) {
     buffer[current_index++] = consume_char(l);
   }
   consume_char(l);
-  l->state = LS_DEFAULT;
-  char path[256] = {0};
-  char fn[256] = {0};
-  strcpy(fn, l->filename);
-  strcpy(path, dirname(fn));
-  strcat(path, "/");
-  strcat(path, buffer);
-  unsigned int old_arena = get_arena();
-  set_arena(inc_arena);
-  char *rpath = alloc(PATH_MAX, 1);
-  set_arena(old_arena);
-  realpath(path, rpath);
-
-  bool path_found = false;
-
-  for (size_t i = 0; i < ul_dyn_length(included_files); i++) {
-    char *str = dyn_str_get(included_files, i);
-    if (streq(rpath, str)) {
-      path_found = true;
-      break;
-    }
-  }
-  if (!path_found) {
-    ul_dyn_append(&included_files, rpath);
-    lexer_t included_file_l;
-    new_lexer(&included_file_l, path);
-    lex_program(&included_file_l);
-    for (size_t i = 0; i < ul_dyn_length(included_file_l.toks); i++) {
-      token_t to_append = dyn_tok_get(included_file_l.toks, i);
-      ul_dyn_append(&l->toks, to_append);
-    }
-  }
+  include_file(l, buffer);
   l->state = LS_DEFAULT;
   // l->current_loc =
   return true;
@@ -441,4 +447,49 @@ void lex_program(lexer_t *l) {
   while (step_lexer(l))
     ;
   ul_logger_info("File successfully lexed");
+}
+
+// replays the tokens of the file at path stored in the token cache, the
+// files it includes being included again
+static bool lex_cached(token_array_t *toks, char *path) {
+  token_cache_entry_t e;
+  if (!token_cache_load(path, &e))
+    return false;
+  lexer_t l = {0};
+  unsigned int old_arena = get_arena();
+  set_arena(inc_arena);
+  l.filename = alloc_preset_ptr(1, strlen(path) + 1, path);
+  set_arena(old_arena);
+  l.toks = *toks;
+  l.includes = new_lexer_include_dyn();
+  for (size_t i = 0; i < e.count; i++) {
+    cached_token_t c = e.toks[i];
+    if (c.kind == CACHED_INCLUDE) {
+      include_file(&l, e.strings + c.lexeme);
+      continue;
+    }
+    token_t tok = {.kind = c.kind,
+                   .lexeme = e.strings + c.lexeme,
+                   .location = {c.line, c.col, l.filename}};
+    ul_dyn_append(&l.toks, tok);
+  }
+  ul_dyn_destroy(l.includes);
+  *toks = l.toks;
+  ul_logger_info("File loaded from the token cache");
+  return true;
+}
+
+void lex_file(token_array_t *toks, char *path) {
+  if (lex_cached(toks, path))
+    return;
+  lexer_t l;
+  new_lexer(&l, path);
+  ul_dyn_destroy(l.toks);
+  l.toks = *toks;
+  l.first_token = ul_dyn_length(l.toks);
+  lex_program(&l);
+  *toks = l.toks;
+  token_cache_store(path, l);
+  // the lexemes of the tokens live in the arena of the lexer
+  ul_dyn_destroy(l.includes);
 }
\ No newline at end of file
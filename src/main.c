@@ -1,7 +1,6 @@
 #include "../include/ul_flow.h"
 
 int main(int argc, char **argv) {
-  ul_start(argc, argv);
-  ul_end();
+  ul_end(ul_start(argc, argv));
   return 0;
 }
\ No newline at end of file
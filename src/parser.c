@@ -24,6 +24,7 @@ parser_t new_parser(token_array_t toks) {
   res.arena = arena;
   res.toks = toks;
   res.current_index = 0;
+  res.map_types = new_ast_dyn();
   return res;
 }
 
@@ -92,6 +93,8 @@ ast_t parse_program(parser_t *p) {
     ast_t stmt = parse_statement(p);
     ul_dyn_append(&prog->as.prog->prog, stmt);
   }
+  ul_dyn_destroy(prog->as.prog->map_types);
+  prog->as.prog->map_types = p->map_types;
   return prog;
 }
 
@@ -120,6 +123,20 @@ bool is_fundef(parser_t p) {
   return true;
 }
 
+bool is_fundef_annotation(token_t tok) {
+  return tok.kind == T_WORD &&
+         (streq(tok.lexeme, "comptime") || streq(tok.lexeme, "inline"));
+}
+
+// pattern: <annotation> [annotations] let <funname>(...
+bool is_annotated_fundef(parser_t p) {
+  if (is_parser_done(p) || !is_fundef_annotation(peek_parser(p)))
+    return false;
+  while (!is_parser_done(p) && is_fundef_annotation(peek_parser(p)))
+    consume_parser(&p);
+  return is_fundef(p);
+}
+
 bool is_funcall(parser_t p) {
   // pattern: <funname>(...
   if (peek_kind(p) != T_WORD) {
@@ -322,6 +339,23 @@ ast_t parse_fundef(parser_t *p) {
   return new_fundef(loc, params, ret_type, tok.lexeme, body);
 }
 
+// [comptime] [inline] let <name>([params])
+ast_t parse_annotated_fundef(parser_t *p) {
+  bool is_comptime = false;
+  bool is_inline = false;
+  while (is_fundef_annotation(peek_parser(*p))) {
+    token_t tok = consume_parser(p);
+    if (streq(tok.lexeme, "comptime"))
+      is_comptime = true;
+    else
+      is_inline = true;
+  }
+  ast_t fundef = parse_fundef(p);
+  fundef->as.fundef->is_comptime = is_comptime;
+  fundef->as.fundef->is_inline = is_inline;
+  return fundef;
+}
+
 ast_t parse_funcall(parser_t *p) {
   expect(*p, T_WORD);
   location_t loc = peek_loc(*p);
@@ -361,8 +395,11 @@ ast_t parse_tdef_struct(parser_t *p) {
   str_array_t types = new_str_dyn();
   ast_array_t methods = new_ast_dyn();
   while (peek_kind(*p) != T_CLOSEBRACE) {
-    if (is_fundef(*p)) {
-      ast_t fdef = parse_fundef(p);
+    if (is_fundef(*p) || is_annotated_fundef(*p)) {
+      location_t fdef_loc = peek_loc(*p);
+      ast_t fdef = parse_annotated_fundef(p);
+      ul_assert_location(fdef_loc, !fdef->as.fundef->is_comptime,
+                         "Methods cannot be comptime");
       unsigned int old_arena = get_arena();
       char prefix[256] = "__internal_";
       strcat(prefix, type_name);
@@ -377,7 +414,7 @@ ast_t parse_tdef_struct(parser_t *p) {
       set_arena(old_arena);
       fdef->as.fundef->name = mangled_name;
       ast_t this_param =
-          new_fundef_param(loc, new_type(loc, type_name, 0), "this");
+          new_fundef_param(loc, new_type(loc, type_name, 0, false), "this");
       ul_dyn_append(&fdef->as.fundef->params, this_param);
       ul_dyn_append(&methods, fdef);
     } else {
@@ -396,7 +433,7 @@ ast_t parse_tdef_struct(parser_t *p) {
   expect(*p, T_CLOSEBRACE);
   consume_parser(p);
   // TODO: actually calculates the size of type
-  type_t res = {{0}, TY_STRUCT, types, fields, methods, false, false, 0, 0};
+  type_t res = {{0}, TY_STRUCT, types, fields, methods, false, false, 0, 0, false};
   strcpy(res.name, type_name);
   res.list_n = 0;
   res.kind = TY_STRUCT;
@@ -516,6 +553,11 @@ ast_t parse_statement(parser_t *p) {
                             "Parsing current statement as fundef");
     return parse_fundef(p);
   }
+  if (is_annotated_fundef(*p)) {
+    ul_logger_info_location(peek_parser(*p).location,
+                            "Parsing current statement as annotated fundef");
+    return parse_annotated_fundef(p);
+  }
   if (streq(tok.lexeme, "struct")) {
     ul_logger_info_location(peek_parser(*p).location,
                             "Parsing current statement as struct");
@@ -637,18 +679,72 @@ ast_t parse_loop(parser_t *p) {
   return new_loop(loc, varname, init, end, body, is_strict);
 }
 
+// map[K, V] is named __ul_map_K__V, which is also the name of its C type
+char *parse_map_type_name(parser_t *p, ast_t *key, ast_t *value) {
+  location_t loc = peek_loc(*p);
+  expect(*p, T_OPENBRACKET);
+  consume_parser(p);
+  *key = parse_type(p);
+  expect(*p, T_COMMA);
+  consume_parser(p);
+  *value = parse_type(p);
+  expect(*p, T_CLOSEBRACKET);
+  consume_parser(p);
+  ul_assert_location(loc,
+                     (*key)->as.type->list_n == 0 &&
+                         (*value)->as.type->list_n == 0,
+                     "The keys and values of maps cannot be arrays");
+  char mangled[256] = {0};
+  snprintf(mangled, sizeof(mangled), "__ul_map_%s__%s", (*key)->as.type->name,
+           (*value)->as.type->name);
+  for (size_t i = 0; i < ul_dyn_length(p->map_types); i++) {
+    ast_t t = dyn_ast_get(p->map_types, i);
+    if (streq(t->as.type->name, mangled))
+      return t->as.type->name;
+  }
+  unsigned int old_arena = get_arena();
+  unsigned int arena = new_arena(strlen(mangled) + 1);
+  set_arena(arena);
+  char *name = alloc_zero(strlen(mangled) + 1, 1);
+  strcpy(name, mangled);
+  set_arena(old_arena);
+  ast_t map_type = new_type(loc, name, 0, false);
+  map_type->as.type->key = *key;
+  map_type->as.type->value = *value;
+  ul_dyn_append(&p->map_types, map_type);
+  return name;
+}
+
 ast_t parse_type(parser_t *p) {
   expect(*p, T_WORD);
   location_t loc = peek_loc(*p);
   char *name = consume_parser(p).lexeme;
+  ast_t key = NULL;
+  ast_t value = NULL;
+  if (streq(name, "map") && peek_kind(*p) == T_OPENBRACKET)
+    name = parse_map_type_name(p, &key, &value);
   int list_n = 0;
+  bool is_slice = false;
   while (peek_kind(*p) == T_OPENBRACKET) {
+    location_t bracket_loc = peek_loc(*p);
+    ul_assert_location(bracket_loc, !is_slice,
+                       "Slices can only be the outermost dimension of a type");
     consume_parser(p);
+    // T[..] is a slice of the elements T
+    if (peek_kind(*p) == T_DOT) {
+      consume_parser(p);
+      expect(*p, T_DOT);
+      consume_parser(p);
+      is_slice = true;
+    }
     expect(*p, T_CLOSEBRACKET);
     consume_parser(p);
     list_n++;
   }
-  return new_type(loc, name, list_n);
+  ast_t res = new_type(loc, name, list_n, is_slice);
+  res->as.type->key = key;
+  res->as.type->value = value;
+  return res;
 }
 
 ast_t parse_vardef(parser_t *p) {
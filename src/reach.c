@@ -0,0 +1,289 @@
+// REACH SOURCE FILE
+// Paul Passeron
+
+// Dead code elimination.
+// Starting from entry and the top level variables, the functions that may be
+// called and the types that are used are marked until nothing changes, and
+// only those are emitted: the standard library is included whole, but a
+// program rarely uses all of it.
+// The type of the receiver of a method call is not known here, so calling
+// a method marks the methods of that name of every struct type in use.
+
+#include "../include/reach.h"
+#include "../include/str_set.h"
+#include "../include/ul_allocator.h"
+#include "../include/ul_compiler_globals.h"
+#include <stdio.h>
+#include <string.h>
+
+// The definitions of a program by name, each stored at the index of its name
+// in the set
+typedef struct def_table_t {
+  str_set_t names;
+  ast_t *defs;
+} def_table_t;
+
+static def_table_t functions;
+static def_table_t structs;
+static str_set_t used_functions;
+static str_set_t used_methods; // without their type, see inline.c
+static str_set_t used_types;
+static ast_array_t used_structs;
+static str_set_t reached; // names of the functions and methods to emit
+static ast_array_t pending; // reached functions and methods not walked yet
+// a binary operation may work on strings, converting its operands with the
+// functions string_of_<type>, see generate_binop
+static bool converts_to_string;
+
+static const char *def_name(ast_t def) {
+  return def->kind == A_FUNDEF ? def->as.fundef->name
+                               : def->as.tdef->type.name;
+}
+
+static bool is_struct(ast_t stmt) {
+  return stmt->kind == A_TDEF && stmt->as.tdef->type.kind == TY_STRUCT;
+}
+
+static def_table_t new_def_table(ast_array_t contents, ast_kind_t kind) {
+  def_table_t res = {.names = new_str_set()};
+  for (size_t i = 0; i < ul_dyn_length(contents); i++) {
+    ast_t stmt = dyn_ast_get(contents, i);
+    if (stmt->kind == kind && (kind == A_FUNDEF || is_struct(stmt)))
+      str_set_insert(&res.names, def_name(stmt));
+  }
+  unsigned int old_arena = get_arena();
+  set_arena(new_arena(res.names.capacity * sizeof(ast_t)));
+  res.defs = alloc_zero(res.names.capacity, sizeof(ast_t));
+  set_arena(old_arena);
+  for (size_t i = 0; i < ul_dyn_length(contents); i++) {
+    ast_t stmt = dyn_ast_get(contents, i);
+    if (stmt->kind == kind && (kind == A_FUNDEF || is_struct(stmt)))
+      res.defs[str_set_index(res.names, def_name(stmt))] = stmt;
+  }
+  return res;
+}
+
+static ast_t find_def(def_table_t table, const char *name) {
+  long index = str_set_index(table.names, name);
+  return index >= 0 ? table.defs[index] : NULL;
+}
+
+static void reach(ast_t fundef) {
+  if (str_set_insert(&reached, fundef->as.fundef->name))
+    ul_dyn_append(&pending, fundef);
+}
+
+static void use_function(const char *name) {
+  if (name == NULL || !str_set_insert(&used_functions, name))
+    return;
+  ast_t fundef = find_def(functions, name);
+  if (fundef != NULL)
+    reach(fundef);
+}
+
+static void use_string_of(const char *type) {
+  char name[256];
+  snprintf(name, sizeof(name), "string_of_%s", type);
+  ast_t fundef = find_def(functions, name);
+  if (fundef != NULL)
+    reach(fundef);
+}
+
+// name of a method without its type, mangled as __internal_<type>_<method>
+static const char *method_name(type_t t, ast_t method) {
+  return method->as.fundef->name + strlen("__internal_") + strlen(t.name) + 1;
+}
+
+static void use_method(const char *name) {
+  if (!str_set_insert(&used_methods, name))
+    return;
+  for (size_t i = 0; i < ul_dyn_length(used_structs); i++) {
+    type_t t = dyn_ast_get(used_structs, i)->as.tdef->type;
+    for (size_t m = 0; m < ul_dyn_length(t.methods); m++) {
+      ast_t method = dyn_ast_get(t.methods, m);
+      if (streq(method_name(t, method), name))
+        reach(method);
+    }
+  }
+}
+
+static void use_type(const char *name) {
+  if (name == NULL || !str_set_insert(&used_types, name))
+    return;
+  if (converts_to_string)
+    use_string_of(name);
+  ast_t tdef = find_def(structs, name);
+  if (tdef == NULL)
+    return;
+  ul_dyn_append(&used_structs, tdef);
+  type_t t = tdef->as.tdef->type;
+  for (size_t i = 0; i < ul_dyn_length(t.members_types); i++)
+    use_type(dyn_str_get(t.members_types, i));
+  for (size_t m = 0; m < ul_dyn_length(t.methods); m++) {
+    ast_t method = dyn_ast_get(t.methods, m);
+    if (str_set_contains(used_methods, method_name(t, method)))
+      reach(method);
+  }
+}
+
+static void use_string_conversions(void) {
+  if (converts_to_string)
+    return;
+  converts_to_string = true;
+  for (size_t i = 0; i < used_types.capacity; i++) {
+    if (used_types.slots[i] != NULL)
+      use_string_of(used_types.slots[i]);
+  }
+}
+
+static void mark_type(ast_t type) {
+  if (type == NULL)
+    return;
+  if (type->kind == A_IDEN) {
+    use_type(type->as.iden->content);
+    return;
+  }
+  use_type(type->as.type->name);
+  mark_type(type->as.type->key);
+  mark_type(type->as.type->value);
+}
+
+static void walk(ast_t node);
+
+static void walk_array(ast_array_t nodes) {
+  for (size_t i = 0; i < ul_dyn_length(nodes); i++)
+    walk(dyn_ast_get(nodes, i));
+}
+
+static void walk(ast_t node) {
+  if (node == NULL)
+    return;
+  switch (node->kind) {
+  case A_FUNCALL:
+    use_function(node->as.funcall->name);
+    walk_array(node->as.funcall->args);
+    break;
+  // functions are also passed by name, as with sort_by()
+  case A_IDEN:
+    use_function(node->as.iden->content);
+    break;
+  case A_BINOP: {
+    token_kind_t op = node->as.binop->op;
+    if (op == T_EQ || op == T_DIFF || op == T_PLUS) {
+      use_function("streq");
+      use_function("addstr");
+      use_function("string_of_signed_int");
+      use_function("string_of_unsigned_int");
+      use_string_conversions();
+    }
+    walk(node->as.binop->left);
+    walk(node->as.binop->right);
+  } break;
+  case A_UNARY:
+    walk(node->as.unary->operand);
+    break;
+  case A_ACCESS:
+    walk(node->as.access->object);
+    if (node->as.access->field->kind == A_FUNCALL) {
+      ast_funcall_t f = *node->as.access->field->as.funcall;
+      use_method(f.name);
+      walk_array(f.args);
+    }
+    break;
+  case A_INDEX:
+    walk(node->as.index->value);
+    walk(node->as.index->index);
+    break;
+  case A_ASSIGN:
+    walk(node->as.assign->expr);
+    walk(node->as.assign->value);
+    break;
+  case A_VARDEF: {
+    ast_t type = node->as.vardef->type;
+    mark_type(type);
+    // the constructor of a struct is called where its variables are defined
+    if (type->kind == A_TYPE)
+      use_method(type->as.type->name);
+    walk(node->as.vardef->value);
+  } break;
+  case A_RETURN:
+    walk(node->as.retstmt->expr);
+    break;
+  case A_COMPOUND:
+    walk_array(node->as.compound->stmts);
+    break;
+  case A_IF:
+    walk(node->as.ifstmt->condition);
+    walk(node->as.ifstmt->ifstmt);
+    walk(node->as.ifstmt->elsestmt);
+    break;
+  case A_WHILE:
+    walk(node->as.whilestmt->condition);
+    walk(node->as.whilestmt->stmt);
+    break;
+  case A_LOOP:
+    walk(node->as.loop->init);
+    walk(node->as.loop->end);
+    walk(node->as.loop->stmt);
+    break;
+  // iterating over a struct calls its methods next() and get()
+  case A_ITER:
+    use_method("next");
+    use_method("get");
+    walk(node->as.iter->itered);
+    walk(node->as.iter->stmt);
+    break;
+  default:
+    break;
+  }
+}
+
+static void walk_fundef(ast_t fundef) {
+  ast_fundef_t f = *fundef->as.fundef;
+  mark_type(f.return_type);
+  for (size_t i = 0; i < ul_dyn_length(f.params); i++)
+    mark_type(dyn_ast_get(f.params, i)->as.fundef_param->type);
+  walk_array(f.body);
+}
+
+void analyse_reachability(ast_t prog) {
+  ast_array_t contents = prog->as.prog->prog;
+  functions = new_def_table(contents, A_FUNDEF);
+  structs = new_def_table(contents, A_TDEF);
+  used_functions = new_str_set();
+  used_methods = new_str_set();
+  used_types = new_str_set();
+  used_structs = new_ast_dyn();
+  reached = new_str_set();
+  pending = new_ast_dyn();
+  converts_to_string = false;
+  use_function("entry");
+  // the runtime works with strings
+  use_type("string");
+  ast_array_t maps = prog->as.prog->map_types;
+  for (size_t i = 0; i < ul_dyn_length(maps); i++)
+    mark_type(dyn_ast_get(maps, i));
+  for (size_t i = 0; i < ul_dyn_length(contents); i++) {
+    ast_t stmt = dyn_ast_get(contents, i);
+    if (stmt->kind == A_VARDEF)
+      walk(stmt);
+  }
+  // each function is walked once, when it is first reached
+  while (ul_dyn_length(pending) > 0) {
+    ast_t fundef = dyn_ast_get(pending, ul_dyn_length(pending) - 1);
+    ul_dyn_destroy_last(&pending);
+    walk_fundef(fundef);
+  }
+}
+
+bool is_reachable(ast_t stmt) {
+  switch (stmt->kind) {
+  case A_FUNDEF:
+    return str_set_contains(reached, stmt->as.fundef->name);
+  case A_TDEF:
+    return !is_struct(stmt) ||
+           str_set_contains(used_types, stmt->as.tdef->type.name);
+  default:
+    return true;
+  }
+}
@@ -0,0 +1,669 @@
+// REGION SOURCE FILE
+// Paul Passeron
+
+// Region inference for the arenas of the compiled program.
+// The generator opens a region around a loop body or a function body when
+// nothing allocated inside of it can still be reached once it is left, and the
+// runtime then destroys all the arenas created meanwhile when it is closed.
+// An allocation can only outlive its scope if it is returned, stored into an
+// object that comes from outside of the scope (a parameter, a global, a
+// variable declared before the scope or a local aliasing one of those), or
+// handed to a function that stores it into its arguments or into a global.
+// The functions summaries are computed for the whole program as a fixpoint,
+// starting from "stores nothing" and growing until no summary changes.
+
+#include "../include/region.h"
+#include "../include/escape.h"
+#include "../include/generator.h"
+#include "../include/ul_compiler_globals.h"
+#include <string.h>
+
+region_summary_array_t region_summaries;
+ast_t region_prog;
+
+// Builtin array methods that store into the array
+static const char *storing_array_methods[] = {"append", "set"};
+// Runtime functions that store into their arguments
+static const char *storing_builtins[] = {"append_string"};
+// Runtime functions that create arenas
+static const char *allocating_builtins[] = {"alloc_buffer", "new_string",
+                                            "char_to_string", "append_string"};
+
+// A type as written in the source, name is NULL when it is not known
+typedef struct rtype_t {
+  const char *name;
+  int list_n;
+} rtype_t;
+
+typedef struct region_var_t {
+  char name[128];
+  rtype_t type;
+  int origin;
+} region_var_t;
+
+typedef __internal_dyn_array_t region_var_array_t;
+#define dyn_region_var_get(arr, index) ul_dyn_get(arr, index, region_var_t)
+#define new_region_var_dyn() new_dyn(region_var_t, false)
+
+typedef struct region_walk_t {
+  region_var_array_t vars;   // variables declared in the scope so far
+  region_var_array_t taints; // origins of the values later assigned to them
+  bool tainted;              // a taint grew during the last walk
+  int outside;               // origin of the variables not declared in it
+  int flags;
+} region_walk_t;
+
+static bool in_list(const char *name, const char **list, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (streq(name, list[i]))
+      return true;
+  }
+  return false;
+}
+
+static rtype_t type_of_ast(ast_t type) {
+  if (type->kind == A_IDEN)
+    return (rtype_t){type->as.iden->content, 0};
+  return (rtype_t){type->as.type->name, type->as.type->list_n};
+}
+
+static bool is_scalar(rtype_t t) {
+  return t.name != NULL && t.list_n == 0 && is_int_type((char *)t.name);
+}
+
+static bool is_string(rtype_t t) {
+  return t.name != NULL && t.list_n == 0 && streq(t.name, "string");
+}
+
+static bool find_type(const char *name, type_t *res) {
+  for (size_t i = 0; i < ul_dyn_length(generator.context.types); i++) {
+    type_t t = dyn_type_get(generator.context.types, i);
+    if (streq(t.name, name)) {
+      *res = t;
+      return true;
+    }
+  }
+  return false;
+}
+
+// returns whether t is a map[K, V] type, setting *map to its registered type
+static bool find_map(rtype_t t, type_t *map) {
+  return t.name != NULL && t.list_n == 0 && find_type(t.name, map) &&
+         map->kind == TY_MAP;
+}
+
+static ast_t find_function(const char *name) {
+  ast_array_t contents = region_prog->as.prog->prog;
+  for (size_t i = 0; i < ul_dyn_length(contents); i++) {
+    ast_t stmt = dyn_ast_get(contents, i);
+    if (stmt->kind == A_FUNDEF && streq(stmt->as.fundef->name, name))
+      return stmt;
+  }
+  return NULL;
+}
+
+static ast_t find_method(rtype_t t, const char *method) {
+  type_t st;
+  if (t.name == NULL || t.list_n > 0 || !find_type(t.name, &st) ||
+      st.kind != TY_STRUCT)
+    return NULL;
+  char actual_name[256] = {0};
+  sprintf(actual_name, "__internal_%s_%s", t.name, method);
+  for (size_t i = 0; i < ul_dyn_length(st.methods); i++) {
+    ast_t m = dyn_ast_get(st.methods, i);
+    if (streq(m->as.fundef->name, actual_name))
+      return m;
+  }
+  return NULL;
+}
+
+static int summary_stores(ast_t fundef) {
+  for (size_t i = 0; i < ul_dyn_length(region_summaries); i++) {
+    region_summary_t s = dyn_region_summary_get(region_summaries, i);
+    if (streq(s.name, fundef->as.fundef->name))
+      return s.stores;
+  }
+  return FROM_PARAMS | FROM_OUTSIDE | ALLOCATES;
+}
+
+static region_var_t *find_var(region_walk_t *w, const char *name) {
+  for (int i = ul_dyn_length(w->vars) - 1; i >= 0; i--) {
+    region_var_t *v = ul_dyn_get_ptr(w->vars, i, region_var_t *);
+    if (streq(v->name, name))
+      return v;
+  }
+  return NULL;
+}
+
+static region_var_t *find_taint(region_walk_t *w, const char *name) {
+  for (size_t i = 0; i < ul_dyn_length(w->taints); i++) {
+    region_var_t *v = ul_dyn_get_ptr(w->taints, i, region_var_t *);
+    if (streq(v->name, name))
+      return v;
+  }
+  return NULL;
+}
+
+static void taint(region_walk_t *w, const char *name, int origin) {
+  region_var_t *t = find_taint(w, name);
+  if (t == NULL) {
+    region_var_t v = {.origin = origin};
+    strcpy(v.name, name);
+    ul_dyn_append(&w->taints, v);
+    w->tainted = true;
+  } else if ((t->origin | origin) != t->origin) {
+    t->origin |= origin;
+    w->tainted = true;
+  }
+}
+
+static void declare(region_walk_t *w, const char *name, rtype_t type,
+                    int origin) {
+  region_var_t v = {.type = type, .origin = origin};
+  strcpy(v.name, name);
+  ul_dyn_append(&w->vars, v);
+}
+
+static void forget_vars(region_walk_t *w, size_t length) {
+  while (ul_dyn_length(w->vars) > length) {
+    ul_dyn_destroy_last(&w->vars);
+  }
+}
+
+// Variables of the enclosing scopes are known to the generator, globals are
+// looked up in the program
+static rtype_t type_of_outside_var(const char *name) {
+  for (int i = ul_dyn_length(generator.context.vars) - 1; i >= 0; i--) {
+    var_t *v = ul_dyn_get_ptr(generator.context.vars, i, var_t *);
+    if (streq(v->name, name))
+      return (rtype_t){v->type, v->list_n};
+  }
+  ast_array_t contents = region_prog->as.prog->prog;
+  for (size_t i = 0; i < ul_dyn_length(contents); i++) {
+    ast_t stmt = dyn_ast_get(contents, i);
+    if (stmt->kind == A_VARDEF && streq(stmt->as.vardef->name, name))
+      return type_of_ast(stmt->as.vardef->type);
+  }
+  return (rtype_t){NULL, 0};
+}
+
+static bool is_comparison(token_kind_t op) {
+  switch (op) {
+  case T_GRTR:
+  case T_GRTR_EQ:
+  case T_LSSR:
+  case T_LSSR_EQ:
+  case T_EQ:
+  case T_DIFF:
+  case T_LOG_AND:
+  case T_LOG_OR:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static rtype_t type_of(region_walk_t *w, ast_t expr) {
+  rtype_t unknown = {NULL, 0};
+  switch (expr->kind) {
+  case A_CHARLIT:
+    return (rtype_t){"char", 0};
+  case A_NUMLIT:
+    return (rtype_t){"i64", 0};
+  case A_STRLIT:
+    return (rtype_t){"string", 0};
+  case A_IDEN: {
+    region_var_t *v = find_var(w, expr->as.iden->content);
+    if (v != NULL)
+      return v->type;
+    return type_of_outside_var(expr->as.iden->content);
+  }
+  case A_ACCESS: {
+    ast_access_t a = *expr->as.access;
+    rtype_t t = type_of(w, a.object);
+    if (t.name == NULL)
+      return unknown;
+    type_t map;
+    if (a.field->kind == A_FUNCALL && find_map(t, &map)) {
+      const char *n = a.field->as.funcall->name;
+      if (streq(n, "get"))
+        return (rtype_t){dyn_str_get(map.members_types, 1), 0};
+      if (streq(n, "has") || streq(n, "remove"))
+        return (rtype_t){"bool", 0};
+      if (streq(n, "length"))
+        return (rtype_t){"u64", 0};
+      return unknown;
+    }
+    if (a.field->kind == A_FUNCALL) {
+      ast_t method = find_method(t, a.field->as.funcall->name);
+      if (method != NULL)
+        return type_of_ast(method->as.fundef->return_type);
+      if (t.list_n > 0 && streq(a.field->as.funcall->name, "length"))
+        return (rtype_t){"u32", 0};
+      if (t.list_n > 0 && streq(a.field->as.funcall->name, "get"))
+        return (rtype_t){t.name, t.list_n - 1};
+      if (t.list_n > 0 && streq(a.field->as.funcall->name, "slice"))
+        return t;
+      return unknown;
+    }
+    type_t st;
+    if (t.list_n > 0 || !find_type(t.name, &st) || st.kind != TY_STRUCT)
+      return unknown;
+    for (size_t i = 0; i < ul_dyn_length(st.members_names); i++) {
+      if (streq(dyn_str_get(st.members_names, i), a.field->as.iden->content))
+        return (rtype_t){dyn_str_get(st.members_types, i), 0};
+    }
+    return unknown;
+  }
+  case A_BINOP: {
+    if (is_comparison(expr->as.binop->op))
+      return (rtype_t){"bool", 0};
+    rtype_t t = type_of(w, expr->as.binop->left);
+    return t.name != NULL ? t : type_of(w, expr->as.binop->right);
+  }
+  case A_UNARY:
+    return type_of(w, expr->as.unary->operand);
+  case A_INDEX: {
+    rtype_t t = type_of(w, expr->as.index->value);
+    type_t map;
+    if (find_map(t, &map))
+      return (rtype_t){dyn_str_get(map.members_types, 1), 0};
+    if (t.name != NULL && t.list_n > 0)
+      return (rtype_t){t.name, t.list_n - 1};
+    if (t.name != NULL && (streq(t.name, "cstr") || streq(t.name, "string")))
+      return (rtype_t){"char", 0};
+    return unknown;
+  }
+  case A_FUNCALL: {
+    ast_t fundef = find_function(expr->as.funcall->name);
+    if (fundef != NULL)
+      return type_of_ast(fundef->as.fundef->return_type);
+    return unknown;
+  }
+  default:
+    return unknown;
+  }
+}
+
+static int origin_of(region_walk_t *w, ast_t expr);
+
+// type and origin of expr, computed in one pass over the chains of binops
+// as type_of and origin_of would go down them again at each level
+static rtype_t type_and_origin(region_walk_t *w, ast_t expr, int *origin) {
+  if (expr->kind != A_BINOP) {
+    *origin = origin_of(w, expr);
+    return type_of(w, expr);
+  }
+  ast_binop_t b = *expr->as.binop;
+  int left_origin, right_origin;
+  rtype_t left = type_and_origin(w, b.left, &left_origin);
+  rtype_t right = type_and_origin(w, b.right, &right_origin);
+  // '+' on strings builds a new string
+  if (b.op == T_PLUS && is_string(left))
+    *origin = 0;
+  else
+    *origin = left_origin | right_origin;
+  if (is_comparison(b.op))
+    return (rtype_t){"bool", 0};
+  return left.name != NULL ? left : right;
+}
+
+// The result of a call may alias the arguments given to escaping
+// parameters, or objects reached from its arguments, see param_aliased
+static int call_origin(region_walk_t *w, ast_funcall_t f, ast_t receiver) {
+  int res = 0;
+  size_t n = ul_dyn_length(f.args);
+  for (size_t i = 0; i < n; i++) {
+    bool aliased = receiver == NULL ? param_aliased(f.name, i)
+                                    : method_param_aliased(f.name, i);
+    if (aliased)
+      res |= origin_of(w, dyn_ast_get(f.args, i));
+  }
+  if (receiver != NULL && method_param_aliased(f.name, n))
+    res |= origin_of(w, receiver);
+  return res;
+}
+
+// returns where the object expr refers to may come from, 0 if it was
+// allocated in the scope
+static int origin_of(region_walk_t *w, ast_t expr) {
+  if (expr == NULL)
+    return 0;
+  switch (expr->kind) {
+  case A_IDEN: {
+    region_var_t *v = find_var(w, expr->as.iden->content);
+    if (v == NULL)
+      return w->outside;
+    region_var_t *t = find_taint(w, v->name);
+    return v->origin | (t == NULL ? 0 : t->origin);
+  }
+  case A_ACCESS: {
+    ast_access_t a = *expr->as.access;
+    if (a.field->kind == A_FUNCALL)
+      return call_origin(w, *a.field->as.funcall, a.object);
+    return origin_of(w, a.object);
+  }
+  case A_FUNCALL:
+    return call_origin(w, *expr->as.funcall, NULL);
+  case A_INDEX:
+    return origin_of(w, expr->as.index->value);
+  case A_BINOP: {
+    int res;
+    type_and_origin(w, expr, &res);
+    return res;
+  }
+  case A_UNARY:
+    return origin_of(w, expr->as.unary->operand);
+  default:
+    return 0;
+  }
+}
+
+// Whatever a callee may store into its arguments ends up in the objects they
+// come from
+static void check_call(region_walk_t *w, ast_funcall_t f, ast_t receiver) {
+  int stores;
+  if (receiver == NULL) {
+    ast_t fundef = find_function(f.name);
+    if (fundef != NULL) {
+      stores = summary_stores(fundef);
+    } else {
+      stores = in_list(f.name, storing_builtins,
+                       sizeof(storing_builtins) / sizeof(char *))
+                   ? FROM_PARAMS
+                   : 0;
+      if (in_list(f.name, allocating_builtins,
+                  sizeof(allocating_builtins) / sizeof(char *)))
+        stores |= ALLOCATES;
+    }
+  } else {
+    rtype_t t = type_of(w, receiver);
+    ast_t method = find_method(t, f.name);
+    type_t map;
+    ast_t less = NULL;
+    if (method == NULL && t.list_n > 0 && streq(f.name, "sort_by") &&
+        ul_dyn_length(f.args) == 1 && dyn_ast_get(f.args, 0)->kind == A_IDEN)
+      less = find_function(dyn_ast_get(f.args, 0)->as.iden->content);
+    if (method != NULL)
+      stores = summary_stores(method);
+    else if (less != NULL) {
+      // the comparison is called on the elements of the array
+      stores = summary_stores(less);
+      w->flags |= stores & (FROM_OUTSIDE | ALLOCATES);
+      if (stores & FROM_PARAMS)
+        w->flags |= origin_of(w, receiver);
+      return;
+    } else if (t.name != NULL && t.list_n > 0)
+      // arrays grow within their own arena: only the objects stored into
+      // them are kept alive
+      stores = in_list(f.name, storing_array_methods,
+                       sizeof(storing_array_methods) / sizeof(char *)) &&
+                       !is_scalar((rtype_t){t.name, t.list_n - 1})
+                   ? FROM_PARAMS
+                   : 0;
+    else if (find_map(t, &map)) {
+      // same for maps, through their keys and their values
+      rtype_t key = {dyn_str_get(map.members_types, 0), 0};
+      rtype_t value = {dyn_str_get(map.members_types, 1), 0};
+      stores = streq(f.name, "set") && !(is_scalar(key) && is_scalar(value))
+                   ? FROM_PARAMS
+                   : 0;
+    } else
+      stores = FROM_PARAMS | FROM_OUTSIDE | ALLOCATES;
+  }
+  w->flags |= stores & (FROM_OUTSIDE | ALLOCATES);
+  if (!(stores & FROM_PARAMS))
+    return;
+  for (size_t i = 0; i < ul_dyn_length(f.args); i++) {
+    ast_t arg = dyn_ast_get(f.args, i);
+    if (!is_scalar(type_of(w, arg)))
+      w->flags |= origin_of(w, arg);
+  }
+  if (receiver != NULL)
+    w->flags |= origin_of(w, receiver);
+}
+
+static void walk(region_walk_t *w, ast_t node);
+
+// walks a binop and returns its type, walking chains of binops only once
+static rtype_t walk_binop(region_walk_t *w, ast_t node) {
+  ast_binop_t b = *node->as.binop;
+  rtype_t left, right;
+  if (b.left->kind == A_BINOP) {
+    left = walk_binop(w, b.left);
+  } else {
+    walk(w, b.left);
+    left = type_of(w, b.left);
+  }
+  if (b.right->kind == A_BINOP) {
+    right = walk_binop(w, b.right);
+  } else {
+    walk(w, b.right);
+    right = type_of(w, b.right);
+  }
+  // '+' on strings builds a new string
+  if (b.op == T_PLUS && is_string(left))
+    w->flags |= ALLOCATES;
+  if (is_comparison(b.op))
+    return (rtype_t){"bool", 0};
+  return left.name != NULL ? left : right;
+}
+
+static void walk_array(region_walk_t *w, ast_array_t nodes) {
+  for (size_t i = 0; i < ul_dyn_length(nodes); i++) {
+    walk(w, dyn_ast_get(nodes, i));
+  }
+}
+
+static void walk_scoped(region_walk_t *w, ast_t node) {
+  size_t l = ul_dyn_length(w->vars);
+  walk(w, node);
+  forget_vars(w, l);
+}
+
+static void walk_assign(region_walk_t *w, ast_assign_t a) {
+  walk(w, a.expr);
+  walk(w, a.value);
+  if (is_scalar(type_of(w, a.expr)))
+    return;
+  if (a.expr->kind == A_IDEN) {
+    // rebinding a variable of the scope makes it alias the value
+    region_var_t *v = find_var(w, a.expr->as.iden->content);
+    if (v == NULL)
+      w->flags |= w->outside;
+    else
+      taint(w, v->name, origin_of(w, a.value));
+  } else if (a.expr->kind == A_ACCESS) {
+    w->flags |= origin_of(w, a.expr->as.access->object);
+  } else if (a.expr->kind == A_INDEX) {
+    w->flags |= origin_of(w, a.expr->as.index->value);
+  } else {
+    w->flags |= w->outside;
+  }
+}
+
+static void walk_iter(region_walk_t *w, ast_iter_t i) {
+  walk(w, i.itered);
+  rtype_t t = type_of(w, i.itered);
+  rtype_t elem = {NULL, 0};
+  if (t.name != NULL && t.list_n > 0) {
+    elem = (rtype_t){t.name, t.list_n - 1};
+  } else if (find_method(t, "next") != NULL) {
+    // iterating over a struct calls its next() and get() methods
+    check_call(w, (ast_funcall_t){.name = "next"}, i.itered);
+    check_call(w, (ast_funcall_t){.name = "get"}, i.itered);
+    ast_t method = find_method(t, "get");
+    if (method != NULL)
+      elem = type_of_ast(method->as.fundef->return_type);
+  }
+  size_t l = ul_dyn_length(w->vars);
+  declare(w, i.var->as.iden->content, elem, origin_of(w, i.itered));
+  walk(w, i.stmt);
+  forget_vars(w, l);
+}
+
+static void walk(region_walk_t *w, ast_t node) {
+  if (node == NULL)
+    return;
+  switch (node->kind) {
+  case A_VARDEF: {
+    ast_vardef_t v = *node->as.vardef;
+    walk(w, v.value);
+    if (v.value == NULL && !is_scalar(type_of_ast(v.type)))
+      w->flags |= ALLOCATES;
+    declare(w, v.name, type_of_ast(v.type), origin_of(w, v.value));
+  } break;
+  case A_STRLIT:
+    w->flags |= ALLOCATES;
+    break;
+  case A_ASSIGN:
+    walk_assign(w, *node->as.assign);
+    break;
+  case A_RETURN:
+    w->flags |= RETURNS;
+    walk(w, node->as.retstmt->expr);
+    break;
+  case A_FUNCALL:
+    walk_array(w, node->as.funcall->args);
+    check_call(w, *node->as.funcall, NULL);
+    break;
+  case A_ACCESS: {
+    ast_access_t a = *node->as.access;
+    walk(w, a.object);
+    if (a.field->kind == A_FUNCALL) {
+      walk_array(w, a.field->as.funcall->args);
+      check_call(w, *a.field->as.funcall, a.object);
+    }
+  } break;
+  case A_BINOP:
+    walk_binop(w, node);
+    break;
+  case A_UNARY:
+    walk(w, node->as.unary->operand);
+    break;
+  case A_INDEX:
+    walk(w, node->as.index->value);
+    walk(w, node->as.index->index);
+    break;
+  case A_COMPOUND: {
+    size_t l = ul_dyn_length(w->vars);
+    walk_array(w, node->as.compound->stmts);
+    forget_vars(w, l);
+  } break;
+  case A_IF: {
+    ast_if_t i = *node->as.ifstmt;
+    walk(w, i.condition);
+    walk_scoped(w, i.ifstmt);
+    walk_scoped(w, i.elsestmt);
+  } break;
+  case A_WHILE:
+    walk(w, node->as.whilestmt->condition);
+    walk_scoped(w, node->as.whilestmt->stmt);
+    break;
+  case A_LOOP: {
+    ast_loop_t l = *node->as.loop;
+    walk(w, l.init);
+    walk(w, l.end);
+    size_t length = ul_dyn_length(w->vars);
+    declare(w, l.varname, (rtype_t){"i32", 0}, 0);
+    walk(w, l.stmt);
+    forget_vars(w, length);
+  } break;
+  case A_ITER:
+    walk_iter(w, *node->as.iter);
+    break;
+  default:
+    break;
+  }
+}
+
+static region_walk_t new_walk(int outside) {
+  region_walk_t w = {.outside = outside};
+  w.vars = new_region_var_dyn();
+  w.taints = new_region_var_dyn();
+  return w;
+}
+
+static void destroy_walk(region_walk_t w) {
+  ul_dyn_destroy(w.vars);
+  ul_dyn_destroy(w.taints);
+}
+
+// walks the nodes until the taints of the locals are stable, the flags of the
+// last walk being the ones of the scope
+static void run_walk(region_walk_t *w, ast_array_t nodes) {
+  size_t l = ul_dyn_length(w->vars);
+  do {
+    w->tainted = false;
+    w->flags = 0;
+    walk_array(w, nodes);
+    forget_vars(w, l);
+  } while (w->tainted);
+}
+
+static int compute_stores(ast_t fundef) {
+  ast_fundef_t f = *fundef->as.fundef;
+  region_walk_t w = new_walk(FROM_OUTSIDE);
+  for (size_t i = 0; i < ul_dyn_length(f.params); i++) {
+    ast_fundef_param_t p = *dyn_ast_get(f.params, i)->as.fundef_param;
+    declare(&w, p.name, type_of_ast(p.type), FROM_PARAMS);
+  }
+  run_walk(&w, f.body);
+  destroy_walk(w);
+  return w.flags & (FROM_PARAMS | FROM_OUTSIDE | ALLOCATES);
+}
+
+void analyse_regions(ast_t prog) {
+  region_prog = prog;
+  region_summaries = new_region_summary_dyn();
+  ast_array_t contents = prog->as.prog->prog;
+  for (size_t i = 0; i < ul_dyn_length(contents); i++) {
+    ast_t stmt = dyn_ast_get(contents, i);
+    if (stmt->kind == A_FUNDEF) {
+      region_summary_t s = {
+          .fundef = stmt, .name = stmt->as.fundef->name, .stores = 0};
+      ul_dyn_append(&region_summaries, s);
+    } else if (stmt->kind == A_TDEF &&
+               stmt->as.tdef->type.kind == TY_STRUCT) {
+      type_t t = stmt->as.tdef->type;
+      for (size_t m = 0; m < ul_dyn_length(t.methods); m++) {
+        ast_t fdef = dyn_ast_get(t.methods, m);
+        region_summary_t s = {
+            .fundef = fdef, .name = fdef->as.fundef->name, .stores = 0};
+        ul_dyn_append(&region_summaries, s);
+      }
+    }
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 0; i < ul_dyn_length(region_summaries); i++) {
+      region_summary_t *s =
+          ul_dyn_get_ptr(region_summaries, i, region_summary_t *);
+      int stores = compute_stores(s->fundef);
+      if (stores != s->stores) {
+        s->stores = stores;
+        changed = true;
+      }
+    }
+  }
+}
+
+bool scope_is_releasable(ast_t stmt) {
+  region_walk_t w = new_walk(FROM_PARAMS | FROM_OUTSIDE);
+  ast_array_t nodes = new_ast_dyn();
+  ul_dyn_append(&nodes, stmt);
+  run_walk(&w, nodes);
+  ul_dyn_destroy(nodes);
+  destroy_walk(w);
+  return w.flags == ALLOCATES;
+}
+
+bool function_is_releasable(ast_t fundef) {
+  ast_fundef_t f = *fundef->as.fundef;
+  rtype_t ret = type_of_ast(f.return_type);
+  if (!is_scalar(ret) && !(streq(ret.name, "void") && ret.list_n == 0))
+    return false;
+  return summary_stores(fundef) == ALLOCATES;
+}
@@ -0,0 +1,67 @@
+// STR_SET SOURCE FILE
+// Paul Passeron
+
+#include "../include/str_set.h"
+#include "../include/ul_allocator.h"
+#include "../include/ul_compiler_globals.h"
+
+// FNV-1a
+static size_t hash_str(const char *s) {
+  unsigned long long h = 14695981039346656037ULL;
+  while (*s) {
+    h ^= (unsigned char)*(s++);
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static str_set_t new_str_set_with(size_t capacity) {
+  str_set_t res = {.capacity = capacity, .count = 0};
+  unsigned int old_arena = get_arena();
+  res.arena = new_arena(capacity * sizeof(char *));
+  set_arena(res.arena);
+  res.slots = alloc_zero(capacity, sizeof(char *));
+  set_arena(old_arena);
+  return res;
+}
+
+str_set_t new_str_set(void) { return new_str_set_with(STR_SET_INIT_CAP); }
+
+void destroy_str_set(str_set_t set) { destroy_arena(set.arena); }
+
+// index of the slot holding s, or of the empty slot where it belongs
+static size_t find_slot(str_set_t set, const char *s) {
+  size_t i = hash_str(s) & (set.capacity - 1);
+  while (set.slots[i] != NULL && !streq(set.slots[i], s))
+    i = (i + 1) & (set.capacity - 1);
+  return i;
+}
+
+bool str_set_contains(str_set_t set, const char *s) {
+  return set.slots[find_slot(set, s)] != NULL;
+}
+
+long str_set_index(str_set_t set, const char *s) {
+  size_t i = find_slot(set, s);
+  return set.slots[i] != NULL ? (long)i : -1;
+}
+
+bool str_set_insert(str_set_t *set, const char *s) {
+  // kept at most half full
+  if (2 * (set->count + 1) > set->capacity) {
+    str_set_t grown = new_str_set_with(set->capacity * 2);
+    for (size_t i = 0; i < set->capacity; i++) {
+      if (set->slots[i] != NULL)
+        grown.slots[find_slot(grown, set->slots[i])] = set->slots[i];
+    }
+    grown.count = set->count;
+    destroy_str_set(*set);
+    *set = grown;
+  }
+  size_t i = find_slot(*set, s);
+  if (set->slots[i] != NULL)
+    return false;
+  set->slots[i] = s;
+  set->count++;
+  return true;
+}
@@ -18,7 +18,7 @@ string __internal_cstr_to_string(const char *contents) {
 
 char *__UL_string_to_cstr(string s) { return s->contents; }
 
-string __UL_new_string(u32 count) {
+string __UL_new_string(u64 count) {
   unsigned int old_arena = get_arena();
   unsigned int self_arena = new_arena(sizeof(__ul_internal_string));
   unsigned int arena = new_arena(count + 1);
@@ -53,3 +53,10 @@ string __UL_append_string(string dest, string to_append) {
   destroy_arena(old_arena);
   return dest;
 }
+
+u64 __ul_hash_string(string s) { return __UL_hash_bytes(s->contents, s->length); }
+
+bool __ul_eq_string(string a, string b) {
+  return a->length == b->length &&
+         __UL_bytes_eq(a->contents, b->contents, a->length);
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // mremap
 #include <fcntl.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -6,8 +7,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/syscall.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 typedef char i8;
 typedef unsigned char u8;
@@ -19,8 +25,137 @@ typedef unsigned long u64;
 typedef long i64;
 typedef char *cstr;
 
+// With __UL_RUNTIME_DECLARATIONS defined, the functions and variables of the
+// runtime are only declared: the parts of an incremental build include it
+// this way, and link with the part that defines them
+
 void __UL_exit(u8 exit_code);
 
+/**
+OUTPUT BUFFERS
+*/
+
+// Writes to fd 1 and 2 are gathered here and handed to the kernel in one
+// write: on every newline when the fd is a terminal (always for fd 2), and
+// only when the buffer is full otherwise. Both buffers are flushed by
+// __UL_exit.
+#define __UL_OUT_BUFFER_SIZE 8192
+
+typedef struct __ul_out_buffer_t {
+  char contents[__UL_OUT_BUFFER_SIZE];
+  size_t fill;
+  int is_tty; // -1 until the first write
+} __ul_out_buffer_t;
+
+#ifdef __UL_RUNTIME_DECLARATIONS
+extern __ul_out_buffer_t __ul_out_buffers[2];
+void __UL_write_all(i32 fd, const char *buf, u64 count);
+void __UL_write_line(i32 fd, const char *buf, u64 count);
+void __UL_flush_fd(i32 fd);
+void __UL_flush(void);
+i64 __UL_bwrite(i32 fd, const char *buf, u64 count);
+void __UL_bputchar(i32 fd, char c);
+void __UL_putchar(char c);
+void __UL_write_num(i32 fd, i64 n);
+#else
+__ul_out_buffer_t __ul_out_buffers[2] = {{.fill = 0, .is_tty = -1},
+                                         {.fill = 0, .is_tty = -1}};
+
+void __UL_write_all(i32 fd, const char *buf, u64 count) {
+  while (count > 0) {
+    ssize_t written = write(fd, buf, count);
+    if (written <= 0)
+      return;
+    buf += written;
+    count -= written;
+  }
+}
+
+// Writes buf followed by a new line with a single writev
+void __UL_write_line(i32 fd, const char *buf, u64 count) {
+  struct iovec iov[2] = {{.iov_base = (void *)buf, .iov_len = count},
+                         {.iov_base = "\n", .iov_len = 1}};
+  int first = 0;
+  while (first < 2) {
+    ssize_t written = writev(fd, iov + first, 2 - first);
+    if (written <= 0)
+      return;
+    while (first < 2 && (size_t)written >= iov[first].iov_len) {
+      written -= iov[first].iov_len;
+      first++;
+    }
+    if (first < 2) {
+      iov[first].iov_base = (char *)iov[first].iov_base + written;
+      iov[first].iov_len -= written;
+    }
+  }
+}
+
+void __UL_flush_fd(i32 fd) {
+  if (fd != 1 && fd != 2)
+    return;
+  __ul_out_buffer_t *b = &__ul_out_buffers[fd - 1];
+  __UL_write_all(fd, b->contents, b->fill);
+  b->fill = 0;
+}
+
+void __UL_flush(void) {
+  __UL_flush_fd(1);
+  __UL_flush_fd(2);
+}
+
+i64 __UL_bwrite(i32 fd, const char *buf, u64 count) {
+  if (fd != 1 && fd != 2) {
+    __UL_write_all(fd, buf, count);
+    return count;
+  }
+  if (fd == 2) {
+    // keeps stdout and stderr in order when both go to the same terminal
+    __UL_flush_fd(1);
+  }
+  __ul_out_buffer_t *b = &__ul_out_buffers[fd - 1];
+  if (b->is_tty < 0)
+    b->is_tty = isatty(fd);
+  if (b->fill + count > __UL_OUT_BUFFER_SIZE)
+    __UL_flush_fd(fd);
+  if (count >= __UL_OUT_BUFFER_SIZE) {
+    __UL_write_all(fd, buf, count);
+    return count;
+  }
+  memcpy(b->contents + b->fill, buf, count);
+  b->fill += count;
+  if ((b->is_tty || fd == 2) && memchr(buf, '\n', count) != NULL)
+    __UL_flush_fd(fd);
+  return count;
+}
+
+void __UL_bputchar(i32 fd, char c) {
+  if (fd == 1) {
+    __ul_out_buffer_t *b = &__ul_out_buffers[0];
+    if (b->fill < __UL_OUT_BUFFER_SIZE && c != '\n') {
+      b->contents[b->fill++] = c;
+      return;
+    }
+  }
+  __UL_bwrite(fd, &c, 1);
+}
+
+void __UL_putchar(char c) { __UL_bputchar(1, c); }
+
+void __UL_write_num(i32 fd, i64 n) {
+  char digits[21];
+  size_t i = sizeof(digits);
+  u64 m = n < 0 ? -(u64)n : (u64)n;
+  do {
+    digits[--i] = '0' + m % 10;
+    m /= 10;
+  } while (m > 0);
+  if (n < 0)
+    digits[--i] = '-';
+  __UL_bwrite(fd, digits + i, sizeof(digits) - i);
+}
+#endif
+
 /**
 LOGGER
 */
@@ -37,6 +172,26 @@ typedef struct logger_t {
   FILE *output;
 } logger_t;
 
+#ifdef __UL_RUNTIME_DECLARATIONS
+extern logger_t ul_global_logger;
+void create_logger(logger_t *logger);
+void set_logger_severity(logger_t *logger, logger_severity_t severity);
+void destroy_logger(logger_t logger);
+void logger_log_with_severity(logger_t logger, const char *str,
+                              logger_severity_t severity);
+void logger_info(logger_t logger, const char *str);
+void logger_warn(logger_t logger, const char *str);
+void logger_erro(logger_t logger, const char *str);
+void set_logger_output_file(logger_t *logger, const char *path);
+void set_logger_output(logger_t *logger, FILE *out);
+void ul_logger_info(const char *str);
+void ul_logger_warn(const char *str);
+void ul_logger_erro(const char *str);
+void ul_set_logger_output_file(const char *path);
+void ul_set_logger_output(FILE *out);
+void ul_destroy_logger(void);
+void ul_assert(bool value, const char *msg);
+#else
 logger_t ul_global_logger;
 
 void create_logger(logger_t *logger) {
@@ -61,6 +216,7 @@ void logger_log_with_severity(logger_t logger, const char *str,
                               logger_severity_t severity) {
   if (logger.severity > severity)
     return;
+  __UL_flush();
   switch (severity) {
   case SEV_INFO: {
     fprintf(logger.output, "\033[0;32m[INFO]\033[0m");
@@ -130,6 +286,7 @@ void ul_assert(bool value, const char *msg) {
     __UL_exit(1);
   }
 }
+#endif
 
 /*ARENAS*/
 
@@ -137,14 +294,111 @@ typedef struct arena_t {
   size_t size;
   size_t fill;
   void *contents;
+  // growable buffer released with the arena, see arena_grow_buffer
+  void *buffer;
+  size_t buffer_size;
+#ifdef __UL_ALLOC_STATS
+  int tag; // index in __ul_arena_tags of its creator, -1 if none
+#endif
 } arena_t;
 
+#ifdef __UL_ALLOC_STATS
+// Statistics of the arenas created by a function, printed at exit
+typedef struct __ul_arena_tag_t {
+  const char *tag; // name of the function
+  size_t created;
+  size_t live;       // arenas not destroyed yet
+  size_t live_bytes; // with their buffers
+  size_t peak_bytes; // highest live_bytes
+  size_t requested;  // sizes of the arenas
+  size_t used;       // bytes allocated from them
+} __ul_arena_tag_t;
+
+#define __UL_MAX_ARENA_TAGS 256
+
+// The arenas that the runtime creates for a call of the generated code are
+// tagged with the generated function making the call, rather than with the
+// runtime function creating them
+#define __UL_CREATED_BY(call)                                                  \
+  ({                                                                           \
+    const char *__ul_outer_creator = __ul_arena_creator;                       \
+    __ul_arena_creator = __func__;                                             \
+    __auto_type __ul_created = (call);                                         \
+    __ul_arena_creator = __ul_outer_creator;                                   \
+    __ul_created;                                                              \
+  })
+#endif
+
+// Buffers from this size on are mapped so that mremap can grow them without
+// copying
+#define ARENA_MAP_THRESHOLD (1 << 20)
+
 #define MAX_ARENAS_NUM (1024 * 256)
 
+#ifdef __UL_RUNTIME_DECLARATIONS
+extern arena_t __internal_arenas[MAX_ARENAS_NUM];
+extern bool __internal_arenas_popul[MAX_ARENAS_NUM];
+extern int __internal_current_arena;
+extern unsigned int *__ul_region_log;
+extern size_t __ul_region_log_length;
+extern size_t __ul_region_log_capacity;
+extern size_t __ul_regions_open;
+void __ul_region_log_arena(unsigned int id);
+int get_first_empty_id(void);
+unsigned int new_arena(size_t size);
+#ifdef __UL_ALLOC_STATS
+extern const char *__ul_arena_creator;
+unsigned int __ul_new_tagged_arena(size_t size, const char *tag);
+#define new_arena(size) __ul_new_tagged_arena(size, __func__)
+#endif
+void free_arena_buffer(void *buffer, size_t size);
+void destroy_arena(unsigned int id);
+void *arena_grow_buffer(unsigned int id, size_t size);
+void *arena_replace_buffer(unsigned int id, size_t size, arena_t *old);
+void set_arena(unsigned int id);
+unsigned int get_arena(void);
+void clear_allocator(void);
+size_t __UL_region_push(void);
+void __UL_region_pop(size_t mark);
+void *__internal_alloc(size_t s);
+void *alloc_preset(size_t n, size_t s, char value);
+void *alloc_preset_ptr(size_t n, size_t s, char *value);
+void *alloc_zero(size_t n, size_t s);
+void *alloc(size_t n, size_t s);
+cstr __UL_alloc_buffer(u64 size);
+void __UL_memcopy(cstr dst, const char *src, u64 count);
+void __UL_memmove(cstr dst, const char *src, u64 count);
+i64 __UL_find_byte(const char *buf, u64 len, char c);
+cstr __UL_mmap_file(i32 fd, u64 size);
+void __UL_munmap(cstr addr, u64 size);
+bool __UL_bytes_eq(const char *a, const char *b, u64 len);
+i32 __UL_compare_bytes(const char *a, u64 alen, const char *b, u64 blen);
+i64 __UL_find_bytes(const char *buf, u64 len, const char *needle, u64 n);
+u64 __UL_hash_bytes(const char *buf, u64 len);
+#else
 arena_t __internal_arenas[MAX_ARENAS_NUM] = {0};
 bool __internal_arenas_popul[MAX_ARENAS_NUM] = {0};
 int __internal_current_arena = -1;
 
+// Arenas created while a region is open are logged so that they can all be
+// released when the innermost region is closed
+unsigned int *__ul_region_log = NULL;
+size_t __ul_region_log_length = 0;
+size_t __ul_region_log_capacity = 0;
+size_t __ul_regions_open = 0;
+
+void __ul_region_log_arena(unsigned int id) {
+  if (__ul_region_log_length == __ul_region_log_capacity) {
+    size_t cap =
+        __ul_region_log_capacity == 0 ? 256 : 2 * __ul_region_log_capacity;
+    unsigned int *log = realloc(__ul_region_log, cap * sizeof(unsigned int));
+    ul_assert(log != NULL, "region: Could not grow the region log");
+    __ul_region_log = log;
+    __ul_region_log_capacity = cap;
+  }
+  __ul_region_log[__ul_region_log_length++] = id;
+}
+
 int get_first_empty_id(void) {
   for (int i = 0; i < MAX_ARENAS_NUM; i++) {
     if (!__internal_arenas_popul[i])
@@ -161,21 +415,156 @@ unsigned int new_arena(size_t size) {
   void *contents = malloc(size);
   ul_assert(contents != NULL, "new_arena: Could not allocate contents");
   arena_t tmp = {.size = size, .fill = 0, .contents = contents};
+#ifdef __UL_ALLOC_STATS
+  tmp.tag = -1;
+#endif
   __internal_arenas[res] = tmp;
   __internal_arenas_popul[res] = true;
+  if (__ul_regions_open > 0)
+    __ul_region_log_arena(res);
   return res;
 }
 
+#ifdef __UL_ALLOC_STATS
+__ul_arena_tag_t __ul_arena_tags[__UL_MAX_ARENA_TAGS];
+int __ul_arena_tags_count = 0;
+const char *__ul_arena_creator = NULL; // see __UL_CREATED_BY
+
+// the last tag gathers the arenas of every function past __UL_MAX_ARENA_TAGS
+int __ul_find_arena_tag(const char *tag) {
+  for (int i = 0; i < __ul_arena_tags_count; i++) {
+    if (__ul_arena_tags[i].tag == tag ||
+        strcmp(__ul_arena_tags[i].tag, tag) == 0)
+      return i;
+  }
+  if (__ul_arena_tags_count == __UL_MAX_ARENA_TAGS - 1)
+    tag = "(others)";
+  if (__ul_arena_tags_count == __UL_MAX_ARENA_TAGS)
+    return __UL_MAX_ARENA_TAGS - 1;
+  __ul_arena_tags[__ul_arena_tags_count].tag = tag;
+  return __ul_arena_tags_count++;
+}
+
+void __ul_count_arena_bytes(unsigned int id, long delta) {
+  int tag = __internal_arenas[id].tag;
+  if (tag < 0)
+    return;
+  __ul_arena_tag_t *t = &__ul_arena_tags[tag];
+  t->live_bytes += delta;
+  if (t->live_bytes > t->peak_bytes)
+    t->peak_bytes = t->live_bytes;
+}
+
+unsigned int __ul_new_tagged_arena(size_t size, const char *tag) {
+  unsigned int res = new_arena(size);
+  int index = __ul_find_arena_tag(
+      __ul_arena_creator != NULL ? __ul_arena_creator : tag);
+  __internal_arenas[res].tag = index;
+  __ul_arena_tags[index].created++;
+  __ul_arena_tags[index].live++;
+  __ul_arena_tags[index].requested += size;
+  __ul_count_arena_bytes(res, size);
+  return res;
+}
+
+void __ul_print_alloc_stats(void) {
+  fprintf(stderr, "%-32s %8s %8s %14s %11s %7s %11s\n", "Arenas by creator",
+          "created", "live", "requested KiB", "used KiB", "wasted", "peak KiB");
+  size_t live = 0;
+  size_t live_bytes = 0;
+  for (int i = 0; i < __ul_arena_tags_count; i++) {
+    __ul_arena_tag_t t = __ul_arena_tags[i];
+    fprintf(stderr, "  %-30.30s %8zu %8zu %14zu %11zu %6.1f%% %11zu\n",
+            t.tag, t.created, t.live, t.requested / 1024, t.used / 1024,
+            t.requested == 0 ? 0 : 100.0 * (t.requested - t.used) / t.requested,
+            t.peak_bytes / 1024);
+    live += t.live;
+    live_bytes += t.live_bytes;
+  }
+  fprintf(stderr, "Still alive at exit: %zu arenas, %zu KiB\n", live,
+          live_bytes / 1024);
+}
+
+#define new_arena(size) __ul_new_tagged_arena(size, __func__)
+#endif
+
+void free_arena_buffer(void *buffer, size_t size) {
+  if (size >= ARENA_MAP_THRESHOLD)
+    munmap(buffer, size);
+  else
+    free(buffer);
+}
+
 void destroy_arena(unsigned int id) {
   ul_assert(id < MAX_ARENAS_NUM, "destroy_arena: Max arena number reached");
   ul_assert(__internal_arenas_popul[id],
             "destroy_arena: Cannot destroy arena: No arena found");
   free(__internal_arenas[id].contents);
+  free_arena_buffer(__internal_arenas[id].buffer,
+                    __internal_arenas[id].buffer_size);
+#ifdef __UL_ALLOC_STATS
+  if (__internal_arenas[id].tag >= 0) {
+    __ul_arena_tags[__internal_arenas[id].tag].live--;
+    __ul_count_arena_bytes(id, -(long)(__internal_arenas[id].size +
+                                       __internal_arenas[id].buffer_size));
+  }
+#endif
   __internal_arenas[id] = (arena_t){0};
   __internal_arenas_popul[id] = false;
   // printf("ID IS %d\n", id);
 }
 
+// Resizes the buffer of the arena id to size bytes, keeping its contents
+void *arena_grow_buffer(unsigned int id, size_t size) {
+  arena_t *a = &__internal_arenas[id];
+  void *res;
+  if (size < ARENA_MAP_THRESHOLD) {
+    res = realloc(a->buffer, size);
+    ul_assert(res != NULL, "arena_grow_buffer: Could not grow buffer");
+  } else if (a->buffer_size >= ARENA_MAP_THRESHOLD) {
+    res = mremap(a->buffer, a->buffer_size, size, MREMAP_MAYMOVE);
+    ul_assert(res != MAP_FAILED, "arena_grow_buffer: Could not grow buffer");
+  } else {
+    res = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+               -1, 0);
+    ul_assert(res != MAP_FAILED, "arena_grow_buffer: Could not grow buffer");
+    if (a->buffer != NULL)
+      memcpy(res, a->buffer, a->buffer_size);
+    free(a->buffer);
+  }
+#ifdef __UL_ALLOC_STATS
+  __ul_count_arena_bytes(id, (long)size - (long)a->buffer_size);
+#endif
+  a->buffer = res;
+  a->buffer_size = size;
+  return res;
+}
+
+// Gives the arena id a new buffer of size bytes, its previous buffer is
+// stored in *old for the caller to release with free_arena_buffer once its
+// contents are moved
+void *arena_replace_buffer(unsigned int id, size_t size, arena_t *old) {
+  arena_t *a = &__internal_arenas[id];
+  void *res;
+  if (size < ARENA_MAP_THRESHOLD) {
+    res = malloc(size);
+    ul_assert(res != NULL, "arena_replace_buffer: Could not allocate buffer");
+  } else {
+    res = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+               -1, 0);
+    ul_assert(res != MAP_FAILED,
+              "arena_replace_buffer: Could not allocate buffer");
+  }
+  *old = *a;
+#ifdef __UL_ALLOC_STATS
+  // the old buffer is released by the caller
+  __ul_count_arena_bytes(id, (long)size - (long)a->buffer_size);
+#endif
+  a->buffer = res;
+  a->buffer_size = size;
+  return res;
+}
+
 void set_arena(unsigned int id) {
   ul_assert(__internal_arenas_popul[id], "set_arena: Invalid arena id.");
   __internal_current_arena = id;
@@ -190,6 +579,24 @@ void clear_allocator(void) {
   }
 }
 
+// Opens a region and returns the mark to give back to __UL_region_pop
+size_t __UL_region_push(void) {
+  __ul_regions_open++;
+  return __ul_region_log_length;
+}
+
+// Closes the region opened at mark, destroying the arenas created since then
+// that are still alive
+void __UL_region_pop(size_t mark) {
+  for (size_t i = mark; i < __ul_region_log_length; i++) {
+    unsigned int id = __ul_region_log[i];
+    if (__internal_arenas_popul[id])
+      destroy_arena(id);
+  }
+  __ul_region_log_length = mark;
+  __ul_regions_open--;
+}
+
 void *__internal_alloc(size_t s) {
   ul_assert(__internal_current_arena >= 0,
             "Could not allocate: No arena found");
@@ -201,6 +608,10 @@ void *__internal_alloc(size_t s) {
   void *res = (char *)__internal_arenas[__internal_current_arena].contents +
               __internal_arenas[__internal_current_arena].fill;
   __internal_arenas[__internal_current_arena].fill += s;
+#ifdef __UL_ALLOC_STATS
+  if (__internal_arenas[__internal_current_arena].tag >= 0)
+    __ul_arena_tags[__internal_arenas[__internal_current_arena].tag].used += s;
+#endif
   return res;
 }
 
@@ -235,20 +646,233 @@ void *alloc(size_t n, size_t s) {
   ul_assert(s > 0, "alloc: s should be > 0");
   return __internal_alloc(s * n);
 }
+/* BUFFERS */
+
+cstr __UL_alloc_buffer(u64 size) {
+  unsigned int old_arena = get_arena();
+  set_arena(new_arena(size));
+  cstr res = alloc(size, 1);
+  set_arena(old_arena);
+  return res;
+}
+
+void __UL_memcopy(cstr dst, const char *src, u64 count) {
+  memcpy(dst, src, count);
+}
+
+void __UL_memmove(cstr dst, const char *src, u64 count) {
+  memmove(dst, src, count);
+}
+
+// Returns the offset of the first 'c' in the 'len' bytes of buf, -1 if none
+i64 __UL_find_byte(const char *buf, u64 len, char c) {
+  if (len == 0)
+    return -1;
+  const char *res = memchr(buf, c, len);
+  return res == NULL ? -1 : res - buf;
+}
+
+// Maps 'size' bytes of fd read only, returns NULL on failure
+cstr __UL_mmap_file(i32 fd, u64 size) {
+  void *res = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (res == MAP_FAILED)
+    return NULL;
+  madvise(res, size, MADV_SEQUENTIAL);
+  return res;
+}
+
+void __UL_munmap(cstr addr, u64 size) { munmap(addr, size); }
+
+/* BYTE STRINGS */
+
+// Every search below returns the length searched when there is no match
+
+static size_t __ul_mismatch_scalar(const char *a, const char *b, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    u64 x, y;
+    memcpy(&x, a + i, 8);
+    memcpy(&y, b + i, 8);
+    if (x != y)
+      break;
+  }
+  while (i < n && a[i] == b[i])
+    i++;
+  return i;
+}
+
+static size_t __ul_find_scalar(const char *buf, size_t len, const char *needle,
+                               size_t n) {
+  for (size_t i = 0; i + n <= len; i++) {
+    if (buf[i] == needle[0] && buf[i + n - 1] == needle[n - 1] &&
+        __ul_mismatch_scalar(buf + i, needle, n) == n)
+      return i;
+  }
+  return len;
+}
+
+#if defined(__x86_64__)
+// SSE2 is part of x86-64, AVX2 is only used when the CPU supports it
+static size_t __ul_mismatch_sse2(const char *a, const char *b, size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+    unsigned diff = ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xffff;
+    if (diff != 0)
+      return i + __builtin_ctz(diff);
+  }
+  return i + __ul_mismatch_scalar(a + i, b + i, n - i);
+}
+
+// Candidates are the positions where both the first and the last bytes of
+// the needle match, checked 16 at a time
+static size_t __ul_find_sse2(const char *buf, size_t len, const char *needle,
+                             size_t n) {
+  __m128i first = _mm_set1_epi8(needle[0]);
+  __m128i last = _mm_set1_epi8(needle[n - 1]);
+  size_t i = 0;
+  for (; i + n - 1 + 16 <= len; i += 16) {
+    __m128i f = _mm_loadu_si128((const __m128i *)(buf + i));
+    __m128i l = _mm_loadu_si128((const __m128i *)(buf + i + n - 1));
+    unsigned candidates = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(f, first), _mm_cmpeq_epi8(l, last)));
+    while (candidates != 0) {
+      size_t at = i + __builtin_ctz(candidates);
+      if (__ul_mismatch_sse2(buf + at + 1, needle + 1, n - 2) == n - 2)
+        return at;
+      candidates &= candidates - 1;
+    }
+  }
+  return i + __ul_find_scalar(buf + i, len - i, needle, n);
+}
+
+__attribute__((target("avx2"))) static size_t
+__ul_mismatch_avx2(const char *a, const char *b, size_t n) {
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+    unsigned diff = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+    if (diff != 0)
+      return i + __builtin_ctz(diff);
+  }
+  return i + __ul_mismatch_sse2(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2"))) static size_t
+__ul_find_avx2(const char *buf, size_t len, const char *needle, size_t n) {
+  __m256i first = _mm256_set1_epi8(needle[0]);
+  __m256i last = _mm256_set1_epi8(needle[n - 1]);
+  size_t i = 0;
+  for (; i + n - 1 + 32 <= len; i += 32) {
+    __m256i f = _mm256_loadu_si256((const __m256i *)(buf + i));
+    __m256i l = _mm256_loadu_si256((const __m256i *)(buf + i + n - 1));
+    unsigned candidates = _mm256_movemask_epi8(_mm256_and_si256(
+        _mm256_cmpeq_epi8(f, first), _mm256_cmpeq_epi8(l, last)));
+    while (candidates != 0) {
+      size_t at = i + __builtin_ctz(candidates);
+      if (__ul_mismatch_avx2(buf + at + 1, needle + 1, n - 2) == n - 2)
+        return at;
+      candidates &= candidates - 1;
+    }
+  }
+  return i + __ul_find_sse2(buf + i, len - i, needle, n);
+}
+#endif
+
+// Implementations of the byte string primitives picked for the running CPU
+struct {
+  size_t (*mismatch)(const char *a, const char *b, size_t n);
+  // n >= 2
+  size_t (*find)(const char *buf, size_t len, const char *needle, size_t n);
+} __ul_bytes_ops = {
+#if defined(__x86_64__)
+    __ul_mismatch_sse2, __ul_find_sse2
+#else
+    __ul_mismatch_scalar, __ul_find_scalar
+#endif
+};
+
+__attribute__((constructor)) static void __ul_select_bytes_ops(void) {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    __ul_bytes_ops.mismatch = __ul_mismatch_avx2;
+    __ul_bytes_ops.find = __ul_find_avx2;
+  }
+#endif
+}
+
+bool __UL_bytes_eq(const char *a, const char *b, u64 len) {
+  return __ul_bytes_ops.mismatch(a, b, len) == len;
+}
+
+// Lexicographic order of the bytes of a and b: -1, 0 or 1
+i32 __UL_compare_bytes(const char *a, u64 alen, const char *b, u64 blen) {
+  size_t n = alen < blen ? alen : blen;
+  size_t i = __ul_bytes_ops.mismatch(a, b, n);
+  if (i < n)
+    return (unsigned char)a[i] < (unsigned char)b[i] ? -1 : 1;
+  return alen == blen ? 0 : (alen < blen ? -1 : 1);
+}
+
+// Returns the offset of the first occurrence of needle in buf, -1 if none
+i64 __UL_find_bytes(const char *buf, u64 len, const char *needle, u64 n) {
+  if (n == 0)
+    return 0;
+  if (n > len)
+    return -1;
+  if (n == 1)
+    return __UL_find_byte(buf, len, needle[0]);
+  size_t res = __ul_bytes_ops.find(buf, len, needle, n);
+  return res >= len ? -1 : (i64)res;
+}
+
+// Hashes the bytes of buf a word at a time
+u64 __UL_hash_bytes(const char *buf, u64 len) {
+  const u64 k = 0x9e3779b97f4a7c15ULL;
+  u64 h = len * k;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    u64 w;
+    memcpy(&w, buf + i, 8);
+    h = (h ^ w) * k;
+    h ^= h >> 29;
+  }
+  u64 w = 0;
+  memcpy(&w, buf + i, len - i);
+  h = (h ^ w) * k;
+  h ^= h >> 32;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+#endif
+
 typedef struct __ul_internal_string *string;
 
 string __internal_cstr_to_string(const char *contents);
 char *__UL_string_to_cstr(string s);
-string __UL_new_string(u32 count);
+string __UL_new_string(u64 count);
 string __UL_char_to_string(char c);
 string __UL_append_string(string dest, string to_append);
+u64 __ul_hash_string(string s);
+bool __ul_eq_string(string a, string b);
 
 void __UL_entry();
 
+#ifndef __UL_RUNTIME_DECLARATIONS
 void __UL_exit(u8 exit_code) {
+  __UL_flush();
+#ifdef __UL_ALLOC_STATS
+  __ul_print_alloc_stats();
+#endif
   clear_allocator();
   // ul_destroy_logger();
+  exit(exit_code);
 }
+#endif
 
 #define __UL_syscall1(num, arg) syscall(num, arg)
 #define __UL_syscall2(num, arg1, arg2) syscall(num, arg1, arg2)
@@ -258,6 +882,7 @@ void __UL_exit(u8 exit_code) {
 #define __UL_syscall5(num, arg1, arg2, arg3, arg4, arg5)                       \
   syscall(num, arg1, arg2, arg3, arg4, arg5)
 
+#ifndef __UL_RUNTIME_DECLARATIONS
 int main(void) {
   unsigned int default_arena = new_arena(1);
   set_arena(default_arena);
@@ -267,6 +892,7 @@ int main(void) {
   return 0; // Not needed but used so that all compilers are happy
   // O_TRUNC;
 }
+#endif
 
 typedef struct __internal_array_t *__internal_array_t;
 struct __internal_array_t {
@@ -274,116 +900,510 @@ struct __internal_array_t {
   size_t capacity;
   size_t length;
   size_t stride;
-  unsigned int arena;
-  unsigned int content_arena;
+  unsigned int arena; // holds the header, its buffer holds the contents
   bool is_ptr;
 };
 
+// A view on length contiguous elements owned by an array or a string, passed
+// by value. It stays valid as long as what it views is neither freed nor
+// grown
+typedef struct __ul_slice_t {
+  void *data;
+  size_t length;
+} __ul_slice_t;
+
 #define ARR_MIN_CAP 16
 #define __internal_new_array(type, is_ptr) new_array(sizeof(type), is_ptr)
-__internal_array_t new_array(size_t stride, bool is_ptr);
-void array_t_append_raw(__internal_array_t arr, ...);
 
-#define __UL___internal___internal_array_t_append(elem, arr)                   \
-  array_t_append_raw(arr, elem);
+// The contents of the arrays computed at compile time are static data, such
+// arrays have no arena until they grow
+#define __UL_STATIC_ARENA ((unsigned int)-1)
+
+#ifdef __UL_RUNTIME_DECLARATIONS
+void __UL___internal___internal_array_t_reserve(u64 capacity,
+                                                __internal_array_t arr);
+void resize_arr(__internal_array_t arr);
+__internal_array_t new_array(size_t stride, bool is_ptr);
+void __ul_array_out_of_bounds(size_t index, size_t length);
+void __ul_slice_out_of_bounds(u64 start, u64 end, size_t length);
+__ul_slice_t __UL_buffer_slice(char *buf, u64 length, u64 start, u64 end);
+void __ul_map_missing_key(void);
+#else
+// Makes room for at least capacity elements
+void __UL___internal___internal_array_t_reserve(u64 capacity,
+                                                __internal_array_t arr) {
+  if (capacity <= arr->capacity)
+    return;
+  if (arr->arena == __UL_STATIC_ARENA) {
+    // they are global: their arena must outlive the regions open meanwhile
+    size_t open = __ul_regions_open;
+    __ul_regions_open = 0;
+    arr->arena = new_arena(1);
+    __ul_regions_open = open;
+    void *contents = arena_grow_buffer(arr->arena, capacity * arr->stride);
+    memcpy(contents, arr->contents, arr->length * arr->stride);
+    arr->contents = contents;
+    arr->capacity = capacity;
+    return;
+  }
+  arr->contents = arena_grow_buffer(arr->arena, capacity * arr->stride);
+  arr->capacity = capacity;
+}
 
 void resize_arr(__internal_array_t arr) {
-  size_t new_cap = 2 * arr->capacity;
+  __UL___internal___internal_array_t_reserve(
+      arr->capacity == 0 ? ARR_MIN_CAP : 2 * arr->capacity, arr);
+}
+
+// The contents are only allocated once the first element is added, or when
+// room is reserved for them
+__internal_array_t new_array(size_t stride, bool is_ptr) {
   unsigned int old_arena = get_arena();
-  unsigned int arena = new_arena(new_cap * arr->stride);
+  unsigned int arena = new_arena(sizeof(struct __internal_array_t));
   set_arena(arena);
-  void *new_contents = alloc(new_cap * arr->stride, 1);
+  __internal_array_t arr = alloc(sizeof(struct __internal_array_t), 1);
   set_arena(old_arena);
-  memcpy(new_contents, arr->contents, arr->stride * arr->capacity);
-  destroy_arena(arr->content_arena);
-  arr->content_arena = arena;
-  arr->capacity = new_cap;
-  arr->contents = new_contents;
+  *arr = (struct __internal_array_t){
+      .stride = stride, .arena = arena, .is_ptr = is_ptr};
+  return arr;
 }
+#endif
 
-typedef struct {
-  i64 dummy;
-} __internal_array_t_cast_t;
+#define __UL___internal___internal_array_t_length(arr) arr->length
 
-void array_t_append_raw(__internal_array_t arr, ...) {
-  if (arr->length >= arr->capacity) {
-    resize_arr(arr);
-  }
-  va_list ptr;
-  va_start(ptr, arr);
-  if (arr->is_ptr) {
-    void *tmp = va_arg(ptr, void *);
-    ((void **)arr->contents)[arr->length] = tmp;
-  } else {
-    __internal_array_t_cast_t tmp = va_arg(ptr, __internal_array_t_cast_t);
-    for (size_t i = 0; i < arr->stride; i++) {
-      ((char *)arr->contents)[i + arr->stride * arr->length] =
-          ((char *)(&tmp))[i];
-    }
-  }
-  arr->length++;
-  va_end(ptr);
+#ifndef __UL_RUNTIME_DECLARATIONS
+void __ul_array_out_of_bounds(size_t index, size_t length) {
+  char msg[128];
+  sprintf(msg, "Index %lld is out of bounds for an array of length %zu",
+          (long long)index, length);
+  ul_assert(false, msg);
 }
+#endif
 
-void array_t_set_raw(__internal_array_t arr, size_t index, ...) {
+// Compiling with --bounds=unchecked defines __UL_BOUNDS_UNCHECKED
+#ifdef __UL_BOUNDS_UNCHECKED
+#define __ul_array_check(index, arr) ((void)0)
+#else
+#define __ul_array_check(index, arr)                                           \
+  do {                                                                         \
+    if (__builtin_expect((index) >= (arr)->length, 0))                         \
+      __ul_array_out_of_bounds(index, (arr)->length);                          \
+  } while (0)
+#endif
 
-  va_list ptr;
-  va_start(ptr, index);
-  if (arr->is_ptr) {
-    void *tmp = va_arg(ptr, void *);
-    va_end(ptr);
-    if (index >= arr->length)
-      return;
-    ((void **)arr->contents)[arr->length] = tmp;
-  } else {
-    __internal_array_t_cast_t tmp = va_arg(ptr, __internal_array_t_cast_t);
-    va_end(ptr);
-    if (index >= arr->length)
-      return;
-    for (size_t i = 0; i < arr->stride; i++) {
-      ((char *)arr->contents)[i + arr->stride * index] = ((char *)(&tmp))[i];
-    }
-  }
+#ifndef __UL_RUNTIME_DECLARATIONS
+void __ul_slice_out_of_bounds(u64 start, u64 end, size_t length) {
+  char msg[128];
+  sprintf(msg, "Slice [%lld, %lld) is out of bounds for a length of %zu",
+          (long long)start, (long long)end, length);
+  ul_assert(false, msg);
 }
+#endif
 
-#define __UL___internal___internal_array_t_set(index, elem, arr)               \
-  array_t_set_raw(arr, index, elem)
+#ifdef __UL_BOUNDS_UNCHECKED
+#define __ul_slice_check(start, end, length) ((void)0)
+#else
+#define __ul_slice_check(start, end, length)                                   \
+  do {                                                                         \
+    if (__builtin_expect((start) > (end) || (end) > (length), 0))              \
+      __ul_slice_out_of_bounds(start, end, length);                            \
+  } while (0)
+#endif
 
-__internal_array_t new_array(size_t stride, bool is_ptr) {
-  unsigned int old_arena = get_arena();
-  unsigned int arena = new_arena(sizeof(struct __internal_array_t));
-  set_arena(arena);
-  __internal_array_t arr = alloc(sizeof(struct __internal_array_t), 1);
-  arr->arena = arena;
-  arr->stride = stride;
-  arr->is_ptr = is_ptr;
-  arr->content_arena = new_arena(ARR_MIN_CAP * stride);
-  set_arena(arr->content_arena);
-  arr->contents = alloc(ARR_MIN_CAP * stride, 1);
-  arr->capacity = ARR_MIN_CAP;
-  arr->length = 0;
-  set_arena(old_arena);
-  return arr;
+#ifndef __UL_RUNTIME_DECLARATIONS
+// The elements start to end (excluded) of a buffer of length bytes
+__ul_slice_t __UL_buffer_slice(char *buf, u64 length, u64 start, u64 end) {
+  __ul_slice_check(start, end, length);
+  return (__ul_slice_t){buf + start, end - start};
 }
+#endif
 
-#define __UL___internal___internal_array_t_get(index, arr, type)               \
-  *((type *)(array_get(index, arr)))
+// Builtin methods of the arrays of T, the generator defines them for every
+// element type so that they compile down to plain accesses to a T *
+// The _unchecked variants are used where the generator proved the indices
+// to be in bounds
+#define __UL_DEFINE_ARRAY(T)                                                   \
+  static inline void __ul_array_##T##_append(T elem, __internal_array_t arr) { \
+    if (arr->length >= arr->capacity)                                          \
+      resize_arr(arr);                                                         \
+    ((T *)arr->contents)[arr->length++] = elem;                                \
+  }                                                                            \
+  static inline T __ul_array_##T##_get_unchecked(size_t index,                 \
+                                                 __internal_array_t arr) {     \
+    return ((T *)arr->contents)[index];                                        \
+  }                                                                            \
+  static inline T __ul_array_##T##_get(size_t index, __internal_array_t arr) { \
+    __ul_array_check(index, arr);                                              \
+    return ((T *)arr->contents)[index];                                        \
+  }                                                                            \
+  static inline void __ul_array_##T##_set_unchecked(size_t index, T elem,      \
+                                                    __internal_array_t arr) {  \
+    ((T *)arr->contents)[index] = elem;                                        \
+  }                                                                            \
+  static inline void __ul_array_##T##_set(size_t index, T elem,                \
+                                          __internal_array_t arr) {            \
+    __ul_array_check(index, arr);                                              \
+    ((T *)arr->contents)[index] = elem;                                        \
+  }                                                                            \
+  static inline void __ul_array_##T##_swap_unchecked(size_t i, size_t j,       \
+                                                     __internal_array_t arr) { \
+    T tmp = ((T *)arr->contents)[i];                                           \
+    ((T *)arr->contents)[i] = ((T *)arr->contents)[j];                         \
+    ((T *)arr->contents)[j] = tmp;                                             \
+  }                                                                            \
+  static inline void __ul_array_##T##_swap(size_t i, size_t j,                 \
+                                           __internal_array_t arr) {           \
+    __ul_array_check(i, arr);                                                  \
+    __ul_array_check(j, arr);                                                  \
+    __ul_array_##T##_swap_unchecked(i, j, arr);                                \
+  }                                                                            \
+  __UL_DEFINE_INTROSORT(__ul_introsort_by_##T, T, __ul_call_less)              \
+  static inline void __ul_array_##T##_sort_by(bool (*less)(T, T),              \
+                                              __internal_array_t arr) {        \
+    __ul_introsort_by_##T(arr->contents, arr->length, less);                   \
+  }                                                                            \
+  static inline __ul_slice_t __ul_array_##T##_slice(u64 start, u64 end,        \
+                                                    __internal_array_t arr) {  \
+    __ul_slice_check(start, end, arr->length);                                 \
+    return (__ul_slice_t){(T *)arr->contents + start, end - start};            \
+  }                                                                            \
+  static inline T __ul_slice_##T##_get_unchecked(size_t index,                 \
+                                                 __ul_slice_t s) {             \
+    return ((T *)s.data)[index];                                               \
+  }                                                                            \
+  static inline T __ul_slice_##T##_get(size_t index, __ul_slice_t s) {         \
+    __ul_array_check(index, &s);                                               \
+    return ((T *)s.data)[index];                                               \
+  }                                                                            \
+  static inline void __ul_slice_##T##_set_unchecked(size_t index, T elem,      \
+                                                    __ul_slice_t s) {          \
+    ((T *)s.data)[index] = elem;                                               \
+  }                                                                            \
+  static inline void __ul_slice_##T##_set(size_t index, T elem,                \
+                                          __ul_slice_t s) {                    \
+    __ul_array_check(index, &s);                                               \
+    ((T *)s.data)[index] = elem;                                               \
+  }                                                                            \
+  static inline __ul_slice_t __ul_slice_##T##_slice(u64 start, u64 end,        \
+                                                    __ul_slice_t s) {          \
+    __ul_slice_check(start, end, s.length);                                    \
+    return (__ul_slice_t){(T *)s.data + start, end - start};                   \
+  }
 
-#define __UL___internal___internal_array_t_length(arr) arr->length
+// SORTING
 
-void *array_get(size_t index, __internal_array_t arr) {
-  if (index > arr->length)
-    return NULL;
-  return (char *)arr->contents + arr->stride * index;
+#define __ul_lt(less, a, b) ((a) < (b))
+#define __ul_call_less(less, a, b) less(a, b)
+
+// Defines NAME(a, n, less), an introsort of the n elements of a, LESS(less,
+// x, y) being the order. Partitions around the median of three, falls back
+// on heapsort when the recursion gets too deep and on insertion sort for
+// small ranges
+#define __UL_DEFINE_INTROSORT(NAME, T, LESS)                                   \
+  static inline void NAME##_insertion(T *a, size_t n, bool (*less)(T, T)) {    \
+    (void)less;                                                                \
+    for (size_t i = 1; i < n; i++) {                                           \
+      T x = a[i];                                                              \
+      size_t j = i;                                                            \
+      for (; j > 0 && LESS(less, x, a[j - 1]); j--)                            \
+        a[j] = a[j - 1];                                                       \
+      a[j] = x;                                                                \
+    }                                                                          \
+  }                                                                            \
+  static inline void NAME##_sift(T *a, size_t root, size_t n,                  \
+                                 bool (*less)(T, T)) {                         \
+    (void)less;                                                                \
+    while (2 * root + 1 < n) {                                                 \
+      size_t child = 2 * root + 1;                                             \
+      if (child + 1 < n && LESS(less, a[child], a[child + 1]))                 \
+        child++;                                                               \
+      if (!LESS(less, a[root], a[child]))                                      \
+        return;                                                                \
+      T tmp = a[root];                                                         \
+      a[root] = a[child];                                                      \
+      a[child] = tmp;                                                          \
+      root = child;                                                            \
+    }                                                                          \
+  }                                                                            \
+  static inline void NAME##_heap(T *a, size_t n, bool (*less)(T, T)) {         \
+    for (size_t i = n / 2; i-- > 0;)                                           \
+      NAME##_sift(a, i, n, less);                                              \
+    for (size_t end = n - 1; end > 0; end--) {                                 \
+      T tmp = a[0];                                                            \
+      a[0] = a[end];                                                           \
+      a[end] = tmp;                                                            \
+      NAME##_sift(a, 0, end, less);                                            \
+    }                                                                          \
+  }                                                                            \
+  static inline void NAME##_rec(T *a, size_t n, bool (*less)(T, T),           \
+                                int depth) {                                   \
+    (void)less;                                                                \
+    while (n > 16) {                                                           \
+      if (depth-- == 0) {                                                      \
+        NAME##_heap(a, n, less);                                               \
+        return;                                                                \
+      }                                                                        \
+      size_t m = (n - 1) / 2;                                                  \
+      T tmp;                                                                   \
+      if (LESS(less, a[m], a[0])) {                                            \
+        tmp = a[m], a[m] = a[0], a[0] = tmp;                                   \
+      }                                                                        \
+      if (LESS(less, a[n - 1], a[0])) {                                        \
+        tmp = a[n - 1], a[n - 1] = a[0], a[0] = tmp;                           \
+      }                                                                        \
+      if (LESS(less, a[n - 1], a[m])) {                                        \
+        tmp = a[n - 1], a[n - 1] = a[m], a[m] = tmp;                           \
+      }                                                                        \
+      T pivot = a[m];                                                          \
+      ptrdiff_t i = -1, j = n;                                                 \
+      for (;;) {                                                               \
+        do                                                                     \
+          i++;                                                                 \
+        while (LESS(less, a[i], pivot));                                       \
+        do                                                                     \
+          j--;                                                                 \
+        while (LESS(less, pivot, a[j]));                                       \
+        if (i >= j)                                                            \
+          break;                                                               \
+        tmp = a[i], a[i] = a[j], a[j] = tmp;                                   \
+      }                                                                        \
+      size_t left = j + 1;                                                     \
+      if (left < n - left) {                                                   \
+        NAME##_rec(a, left, less, depth);                                      \
+        a += left;                                                             \
+        n -= left;                                                             \
+      } else {                                                                 \
+        NAME##_rec(a + left, n - left, less, depth);                           \
+        n = left;                                                              \
+      }                                                                        \
+    }                                                                          \
+    NAME##_insertion(a, n, less);                                              \
+  }                                                                            \
+  static inline void NAME(T *a, size_t n, bool (*less)(T, T)) {               \
+    int depth = 0;                                                             \
+    for (size_t k = n; k > 1; k >>= 1)                                         \
+      depth += 2;                                                              \
+    NAME##_rec(a, n, less, depth);                                             \
+  }
+
+// Key of x whose unsigned order is the order of the integers of type T
+#define __ul_radix_key(T, x)                                                   \
+  ((((T)-1) < (T)0)                                                            \
+       ? ((uint64_t)(x) ^ ((uint64_t)1 << (8 * sizeof(T) - 1)))                \
+       : (uint64_t)(x))
+
+// Builtin sort of the arrays of integers T: radix sort, one pass per byte,
+// for large arrays and introsort otherwise
+#define __UL_DEFINE_ARRAY_SORT(T)                                              \
+  __UL_DEFINE_INTROSORT(__ul_introsort_##T, T, __ul_lt)                        \
+  static inline void __ul_radix_sort_##T(T *a, size_t n) {                     \
+    T *tmp = malloc(n * sizeof(T));                                            \
+    ul_assert(tmp != NULL, "sort: Could not allocate buffer");                 \
+    T *src = a, *dst = tmp;                                                    \
+    for (size_t shift = 0; shift < 8 * sizeof(T); shift += 8) {                \
+      size_t count[257] = {0};                                                 \
+      for (size_t i = 0; i < n; i++)                                           \
+        count[((__ul_radix_key(T, src[i]) >> shift) & 0xff) + 1]++;            \
+      if (count[((__ul_radix_key(T, src[0]) >> shift) & 0xff) + 1] == n)       \
+        continue;                                                              \
+      for (size_t b = 0; b < 256; b++)                                         \
+        count[b + 1] += count[b];                                              \
+      for (size_t i = 0; i < n; i++)                                           \
+        dst[count[(__ul_radix_key(T, src[i]) >> shift) & 0xff]++] = src[i];    \
+      T *t = src;                                                              \
+      src = dst;                                                               \
+      dst = t;                                                                 \
+    }                                                                          \
+    if (src != a)                                                              \
+      memcpy(a, src, n * sizeof(T));                                           \
+    free(tmp);                                                                 \
+  }                                                                            \
+  static inline void __ul_array_##T##_sort(__internal_array_t arr) {           \
+    if (arr->length >= 256)                                                    \
+      __ul_radix_sort_##T(arr->contents, arr->length);                         \
+    else                                                                       \
+      __ul_introsort_##T(arr->contents, arr->length, NULL);                    \
+  }
+
+// MAPS
+
+// Swiss table: the slots are split into groups of 16, each slot having a
+// control byte that is either EMPTY, DELETED or the low 7 bits of the hash
+// of its key. A lookup only compares the keys of the slots of a group whose
+// control byte matches, the 16 control bytes being matched at once
+#define __UL_MAP_GROUP 16
+#define __UL_MAP_EMPTY ((signed char)-128)
+#define __UL_MAP_DELETED ((signed char)-2)
+
+static inline u64 __ul_mix64(u64 x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
 }
 
-void __UL___internal___internal_array_t_swap(size_t i, size_t j,
-                                             __internal_array_t arr) {
-  char *contents[sizeof(__internal_array_t_cast_t)] = {0};
-  memcpy(contents, arr->contents + i * arr->stride, arr->stride);
-  memcpy(arr->contents + i * arr->stride, arr->contents + j * arr->stride,
-         arr->stride);
-  memcpy(arr->contents + j * arr->stride, contents, arr->stride);
+#define __ul_hash_int(k) __ul_mix64((u64)(k))
+#define __ul_eq_int(a, b) ((a) == (b))
+
+// Bit i is set if the control byte i of the group is b
+static inline unsigned __ul_group_match(const signed char *group,
+                                        signed char b) {
+#if defined(__x86_64__)
+  __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(b)));
+#else
+  unsigned res = 0;
+  for (int i = 0; i < __UL_MAP_GROUP; i++)
+    res |= (unsigned)(group[i] == b) << i;
+  return res;
+#endif
 }
 
-void __UL_putchar(char c) { putchar(c); }
\ No newline at end of file
+// Bit i is set if the slot i of the group is EMPTY or DELETED
+static inline unsigned __ul_group_free(const signed char *group) {
+#if defined(__x86_64__)
+  return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+  unsigned res = 0;
+  for (int i = 0; i < __UL_MAP_GROUP; i++)
+    res |= (unsigned)(group[i] < 0) << i;
+  return res;
+#endif
+}
+
+#ifndef __UL_RUNTIME_DECLARATIONS
+void __ul_map_missing_key(void) { ul_assert(false, "Key not found in map"); }
+#endif
+
+// Defines the map NAME from keys K, hashed and compared by __ul_hash_KEYS and
+// __ul_eq_KEYS, to values V. The groups are probed quadratically, and the
+// table is rebuilt once 7/8 of its slots are taken (deleted ones included)
+#define __UL_DEFINE_MAP(NAME, K, V, KEYS)                                      \
+  struct NAME {                                                                \
+    signed char *ctrl;                                                         \
+    K *keys;                                                                   \
+    V *values;                                                                 \
+    size_t capacity;                                                           \
+    size_t length;                                                             \
+    size_t growth_left; /* EMPTY slots that can still be taken */              \
+    unsigned int arena; /* holds the header, its buffer holds the table */     \
+  };                                                                           \
+  static inline NAME NAME##_new(void) {                                        \
+    unsigned int old_arena = get_arena();                                      \
+    unsigned int arena = new_arena(sizeof(struct NAME));                       \
+    set_arena(arena);                                                          \
+    NAME m = alloc(sizeof(struct NAME), 1);                                    \
+    set_arena(old_arena);                                                      \
+    *m = (struct NAME){.arena = arena};                                        \
+    return m;                                                                  \
+  }                                                                            \
+  /* returns the slot of key, capacity if it is not in the map */              \
+  static inline size_t NAME##_find(NAME m, K key, u64 h) {                     \
+    if (m->capacity == 0)                                                      \
+      return 0;                                                                \
+    size_t groups_mask = m->capacity / __UL_MAP_GROUP - 1;                     \
+    size_t g = (h >> 7) & groups_mask;                                         \
+    for (size_t probe = 1;; probe++) {                                         \
+      const signed char *group = m->ctrl + g * __UL_MAP_GROUP;                 \
+      unsigned match = __ul_group_match(group, h & 0x7f);                      \
+      while (match != 0) {                                                     \
+        size_t i = g * __UL_MAP_GROUP + __builtin_ctz(match);                  \
+        if (__ul_eq_##KEYS(m->keys[i], key))                                   \
+          return i;                                                            \
+        match &= match - 1;                                                    \
+      }                                                                        \
+      if (__ul_group_match(group, __UL_MAP_EMPTY) != 0)                        \
+        return m->capacity;                                                    \
+      g = (g + probe) & groups_mask;                                           \
+    }                                                                          \
+  }                                                                            \
+  /* returns the first EMPTY or DELETED slot on the probe sequence of h */     \
+  static inline size_t NAME##_free_slot(NAME m, u64 h) {                       \
+    size_t groups_mask = m->capacity / __UL_MAP_GROUP - 1;                     \
+    size_t g = (h >> 7) & groups_mask;                                         \
+    for (size_t probe = 1;; probe++) {                                         \
+      unsigned avail = __ul_group_free(m->ctrl + g * __UL_MAP_GROUP);          \
+      if (avail != 0)                                                          \
+        return g * __UL_MAP_GROUP + __builtin_ctz(avail);                      \
+      g = (g + probe) & groups_mask;                                           \
+    }                                                                          \
+  }                                                                            \
+  static void NAME##_rebuild(NAME m, size_t capacity) {                        \
+    size_t keys_offset = capacity;                                             \
+    size_t values_offset =                                                     \
+        keys_offset + (capacity * sizeof(K) + 15) / 16 * 16;                   \
+    arena_t old;                                                               \
+    char *table = arena_replace_buffer(                                        \
+        m->arena, values_offset + capacity * sizeof(V), &old);                 \
+    struct NAME prev = *m;                                                     \
+    m->ctrl = (signed char *)table;                                            \
+    m->keys = (K *)(table + keys_offset);                                      \
+    m->values = (V *)(table + values_offset);                                  \
+    m->capacity = capacity;                                                    \
+    m->growth_left = capacity - capacity / 8 - prev.length;                    \
+    memset(m->ctrl, __UL_MAP_EMPTY, capacity);                                 \
+    for (size_t i = 0; i < prev.capacity; i++) {                               \
+      if (prev.ctrl[i] < 0)                                                    \
+        continue;                                                              \
+      u64 h = __ul_hash_##KEYS(prev.keys[i]);                                  \
+      size_t slot = NAME##_free_slot(m, h);                                    \
+      m->ctrl[slot] = h & 0x7f;                                                \
+      m->keys[slot] = prev.keys[i];                                            \
+      m->values[slot] = prev.values[i];                                        \
+    }                                                                          \
+    free_arena_buffer(old.buffer, old.buffer_size);                            \
+  }                                                                            \
+  static inline void NAME##_set(K key, V value, NAME m) {                      \
+    u64 h = __ul_hash_##KEYS(key);                                             \
+    size_t slot = NAME##_find(m, key, h);                                      \
+    if (slot < m->capacity) {                                                  \
+      m->values[slot] = value;                                                 \
+      return;                                                                  \
+    }                                                                          \
+    if (m->growth_left == 0) {                                                 \
+      /* doubles, unless deleted slots are most of the taken ones */           \
+      size_t capacity = m->capacity;                                           \
+      if (capacity == 0)                                                       \
+        capacity = __UL_MAP_GROUP;                                             \
+      else if (m->length >= capacity / 2 - capacity / 16)                      \
+        capacity *= 2;                                                         \
+      NAME##_rebuild(m, capacity);                                             \
+    }                                                                          \
+    slot = NAME##_free_slot(m, h);                                             \
+    if (m->ctrl[slot] == __UL_MAP_EMPTY)                                       \
+      m->growth_left--;                                                        \
+    m->ctrl[slot] = h & 0x7f;                                                  \
+    m->keys[slot] = key;                                                       \
+    m->values[slot] = value;                                                   \
+    m->length++;                                                               \
+  }                                                                            \
+  static inline V NAME##_get(K key, NAME m) {                                  \
+    size_t slot = NAME##_find(m, key, __ul_hash_##KEYS(key));                  \
+    if (__builtin_expect(slot >= m->capacity, 0))                              \
+      __ul_map_missing_key();                                                  \
+    return m->values[slot];                                                    \
+  }                                                                            \
+  static inline bool NAME##_has(K key, NAME m) {                               \
+    return NAME##_find(m, key, __ul_hash_##KEYS(key)) < m->capacity;           \
+  }                                                                            \
+  /* A slot is only made EMPTY again if its group has EMPTY slots: no probe    \
+     sequence can then have gone past it */                                    \
+  static inline bool NAME##_remove(K key, NAME m) {                            \
+    size_t slot = NAME##_find(m, key, __ul_hash_##KEYS(key));                  \
+    if (slot >= m->capacity)                                                   \
+      return false;                                                            \
+    size_t g = slot / __UL_MAP_GROUP;                                          \
+    unsigned empty = __ul_group_match(m->ctrl + g * __UL_MAP_GROUP,            \
+                                      __UL_MAP_EMPTY);                         \
+    if (empty != 0) {                                                          \
+      m->ctrl[slot] = __UL_MAP_EMPTY;                                          \
+      m->growth_left++;                                                        \
+    } else {                                                                   \
+      m->ctrl[slot] = __UL_MAP_DELETED;                                        \
+    }                                                                          \
+    m->length--;                                                               \
+    return true;                                                               \
+  }                                                                            \
+  static inline u64 NAME##_length(NAME m) { return m->length; }
@@ -0,0 +1,126 @@
+// TIME_REPORT SOURCE FILE
+// Paul Passeron
+
+#include "../include/time_report.h"
+#include "../include/ul_allocator.h"
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+
+typedef struct phase_report_t {
+  bool ran;
+  double wall; // in seconds
+  double cpu;
+  size_t peak_bytes;
+} phase_report_t;
+
+static const char *phase_names[PHASE_COUNT] = {"lexer", "parser",
+                                               "generator", "backend"};
+static const char *count_names[COUNT_COUNT] = {"tokens", "AST nodes", "types",
+                                               "variables"};
+static const char *count_keys[COUNT_COUNT] = {"tokens", "ast_nodes", "types",
+                                              "variables"};
+
+static bool enabled = false;
+static bool as_json = false;
+static phase_report_t phases[PHASE_COUNT];
+static size_t counts[COUNT_COUNT];
+static double wall_starts[PHASE_COUNT];
+static double cpu_starts[PHASE_COUNT];
+
+static double wall_time(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static double seconds(struct timeval t) { return t.tv_sec + t.tv_usec / 1e6; }
+
+// the CPU time of the compiler and of the processes it waited for
+static double cpu_time(void) {
+  struct rusage self;
+  struct rusage children;
+  getrusage(RUSAGE_SELF, &self);
+  getrusage(RUSAGE_CHILDREN, &children);
+  return seconds(self.ru_utime) + seconds(self.ru_stime) +
+         seconds(children.ru_utime) + seconds(children.ru_stime);
+}
+
+void enable_time_report(bool json) {
+  enabled = true;
+  as_json = json;
+}
+
+void begin_phase(phase_t phase) {
+  if (!enabled)
+    return;
+  reset_allocator_peak();
+  wall_starts[phase] = wall_time();
+  cpu_starts[phase] = cpu_time();
+}
+
+void end_phase(phase_t phase) {
+  if (!enabled)
+    return;
+  phases[phase] = (phase_report_t){.ran = true,
+                                   .wall = wall_time() - wall_starts[phase],
+                                   .cpu = cpu_time() - cpu_starts[phase],
+                                   .peak_bytes =
+                                       get_allocator_stats().peak_bytes};
+}
+
+void set_report_count(report_count_t which, size_t count) {
+  counts[which] = count;
+}
+
+// on a single line, for the benchmarks to read
+static void print_json_report(void) {
+  fprintf(stderr, "{\"phases\": {");
+  for (int i = 0; i < PHASE_COUNT; i++) {
+    phase_report_t p = phases[i];
+    fprintf(stderr, "%s\"%s\": ", i > 0 ? ", " : "", phase_names[i]);
+    if (!p.ran) {
+      fprintf(stderr, "null");
+      continue;
+    }
+    fprintf(stderr,
+            "{\"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"peak_arena_bytes\": %zu}",
+            p.wall * 1e3, p.cpu * 1e3, p.peak_bytes);
+  }
+  fprintf(stderr, "}, \"counts\": {");
+  for (int i = 0; i < COUNT_COUNT; i++)
+    fprintf(stderr, "\"%s\": %zu, ", count_keys[i], counts[i]);
+  fprintf(stderr, "\"arenas\": %zu}}\n", get_allocator_stats().arenas_created);
+}
+
+void print_time_report(void) {
+  if (!enabled)
+    return;
+  if (as_json) {
+    print_json_report();
+    return;
+  }
+  fprintf(stderr, "%-12s %12s %12s %18s\n", "Time report", "wall (ms)",
+          "CPU (ms)", "peak arenas (KiB)");
+  phase_report_t total = {0};
+  for (int i = 0; i < PHASE_COUNT; i++) {
+    phase_report_t p = phases[i];
+    if (!p.ran) {
+      fprintf(stderr, "  %-10s %12s %12s %18s\n", phase_names[i], "-", "-",
+              "-");
+      continue;
+    }
+    fprintf(stderr, "  %-10s %12.3f %12.3f %18zu\n", phase_names[i],
+            p.wall * 1e3, p.cpu * 1e3, p.peak_bytes / 1024);
+    total.wall += p.wall;
+    total.cpu += p.cpu;
+    if (p.peak_bytes > total.peak_bytes)
+      total.peak_bytes = p.peak_bytes;
+  }
+  fprintf(stderr, "  %-10s %12.3f %12.3f %18zu\n", "total", total.wall * 1e3,
+          total.cpu * 1e3, total.peak_bytes / 1024);
+  for (int i = 0; i < COUNT_COUNT; i++)
+    fprintf(stderr, "%s: %zu, ", count_names[i], counts[i]);
+  fprintf(stderr, "arenas created: %zu\n",
+          get_allocator_stats().arenas_created);
+}
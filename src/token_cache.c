@@ -0,0 +1,221 @@
+// TOKEN_CACHE SOURCE FILE
+// Paul Passeron
+
+// On-disk cache of the tokens of the files lexed by the compiler.
+// Each file has an entry named after a hash of its real path, that holds
+// its own tokens and its @include directives, the included files having
+// entries of their own. On later compilations an entry is mapped and its
+// lexemes are used in place, so that unchanged files (the standard library
+// most of all) are not lexed again.
+
+#include "../include/token_cache.h"
+#include "../include/cache.h"
+#include "../include/logger.h"
+#include "../include/ul_allocator.h"
+#include "../include/ul_assert.h"
+#include "../include/ul_compiler_globals.h"
+#include "../include/ul_io.h"
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ENTRY_PATH_MAX (PATH_MAX + 64)
+
+typedef struct token_cache_header_t {
+  char magic[4]; // "ULTK"
+  unsigned int version;
+  long long mtime_sec; // of the source file when it was lexed
+  long long mtime_nsec;
+  unsigned long long size; // of the source file
+  unsigned long long hash; // of the contents of the source file
+  unsigned long long count;
+  unsigned long long strings_size;
+} token_cache_header_t;
+
+static bool cache_enabled = false;
+
+static unsigned long long hash_bytes(const char *s, size_t n) {
+  return cache_hash(CACHE_HASH_SEED, s, n);
+}
+
+void enable_token_cache(void) { cache_enabled = true; }
+
+static void entry_path(const char *path, char *res) {
+  char rpath[PATH_MAX] = {0};
+  if (realpath(path, rpath) == NULL)
+    strncpy(rpath, path, PATH_MAX - 1);
+  snprintf(res, ENTRY_PATH_MAX, "%s/%016llx.tok", get_cache_dir(),
+           hash_bytes(rpath, strlen(rpath)));
+}
+
+static bool same_mtime(token_cache_header_t h, struct stat src) {
+  return h.mtime_sec == (long long)src.st_mtim.tv_sec &&
+         h.mtime_nsec == (long long)src.st_mtim.tv_nsec;
+}
+
+static bool hash_matches(const char *path, unsigned long long hash,
+                         size_t size) {
+  unsigned int old_arena = get_arena();
+  unsigned int arena = new_arena(size + 1);
+  set_arena(arena);
+  char *buffer;
+  size_t length;
+  read_file(path, &buffer, &length);
+  bool res = length == size && hash_bytes(buffer, length) == hash;
+  set_arena(old_arena);
+  destroy_arena(arena);
+  return res;
+}
+
+// returns whether the entry of st_size bytes mapped at m is well formed
+static bool is_valid_entry(char *m, size_t st_size) {
+  if (st_size < sizeof(token_cache_header_t))
+    return false;
+  token_cache_header_t h = *(token_cache_header_t *)m;
+  if (memcmp(h.magic, "ULTK", 4) != 0 || h.version != TOKEN_CACHE_VERSION)
+    return false;
+  if (h.count > st_size / sizeof(cached_token_t) ||
+      sizeof(h) + h.count * sizeof(cached_token_t) + h.strings_size !=
+          st_size)
+    return false;
+  cached_token_t *toks = (cached_token_t *)(m + sizeof(h));
+  char *strings = (char *)(toks + h.count);
+  if (h.strings_size == 0 || strings[h.strings_size - 1] != 0)
+    return h.count == 0;
+  for (size_t i = 0; i < h.count; i++) {
+    if (toks[i].lexeme >= h.strings_size ||
+        (toks[i].kind > T_LOG_OR && toks[i].kind != CACHED_INCLUDE))
+      return false;
+  }
+  return true;
+}
+
+bool token_cache_load(const char *path, token_cache_entry_t *res) {
+  if (!cache_enabled)
+    return false;
+  struct stat src;
+  if (stat(path, &src) != 0)
+    return false;
+  char entry[ENTRY_PATH_MAX];
+  entry_path(path, entry);
+  int fd = open(entry, O_RDWR);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  char *m = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+    m = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (m == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+  token_cache_header_t *h = (token_cache_header_t *)m;
+  bool valid = is_valid_entry(m, st.st_size) &&
+               h->size == (unsigned long long)src.st_size;
+  if (valid && !same_mtime(*h, src)) {
+    // touched but maybe not changed
+    valid = hash_matches(path, h->hash, src.st_size);
+    if (valid) {
+      h->mtime_sec = src.st_mtim.tv_sec;
+      h->mtime_nsec = src.st_mtim.tv_nsec;
+      if (pwrite(fd, h, sizeof(*h), 0) != sizeof(*h))
+        ul_logger_warn("Could not update an entry of the token cache");
+    }
+  }
+  close(fd);
+  if (!valid) {
+    munmap(m, st.st_size);
+    return false;
+  }
+  // the entry stays mapped while the compiler runs, its lexemes being used
+  // by the tokens
+  res->toks = (cached_token_t *)(m + sizeof(*h));
+  res->count = h->count;
+  res->strings = (char *)(res->toks + h->count);
+  return true;
+}
+
+typedef struct entry_builder_t {
+  cached_token_t *toks;
+  size_t count;
+  char *strings;
+  size_t strings_size;
+  size_t strings_capacity;
+} entry_builder_t;
+
+static void add_token(entry_builder_t *b, unsigned int kind, location_t loc,
+                      const char *lexeme) {
+  size_t length = strlen(lexeme) + 1;
+  while (b->strings_size + length > b->strings_capacity) {
+    b->strings_capacity = 2 * b->strings_capacity + length;
+    b->strings = realloc(b->strings, b->strings_capacity);
+    ul_assert(b->strings != NULL, "Could not allocate the token cache entry");
+  }
+  memcpy(b->strings + b->strings_size, lexeme, length);
+  b->toks[b->count++] = (cached_token_t){kind, loc.line, loc.col,
+                                         b->strings_size};
+  b->strings_size += length;
+}
+
+void token_cache_store(const char *path, lexer_t l) {
+  if (!cache_enabled)
+    return;
+  struct stat src;
+  if (stat(path, &src) != 0)
+    return;
+  size_t includes = ul_dyn_length(l.includes);
+  size_t length = ul_dyn_length(l.toks);
+  entry_builder_t b = {0};
+  b.toks = malloc((length - l.first_token + includes + 1) *
+                  sizeof(cached_token_t));
+  ul_assert(b.toks != NULL, "Could not allocate the token cache entry");
+  // the tokens of the file, without the tokens of the files it includes
+  size_t next = l.first_token;
+  for (size_t i = 0; i <= includes; i++) {
+    lexer_include_t inc = {0};
+    if (i < includes)
+      inc = dyn_lexer_include_get(l.includes, i);
+    size_t end = i < includes ? inc.index : length;
+    for (size_t k = next; k < end; k++) {
+      token_t tok = dyn_tok_get(l.toks, k);
+      add_token(&b, tok.kind, tok.location, tok.lexeme);
+    }
+    if (i < includes) {
+      add_token(&b, CACHED_INCLUDE, (location_t){0}, inc.name);
+      next = inc.index + inc.count;
+    }
+  }
+
+  token_cache_header_t h = {.magic = {'U', 'L', 'T', 'K'},
+                            .version = TOKEN_CACHE_VERSION,
+                            .mtime_sec = src.st_mtim.tv_sec,
+                            .mtime_nsec = src.st_mtim.tv_nsec,
+                            .size = l.buffer_length,
+                            .hash = hash_bytes(l.buffer, l.buffer_length),
+                            .count = b.count,
+                            .strings_size = b.strings_size};
+  char entry[ENTRY_PATH_MAX];
+  entry_path(path, entry);
+  // written aside then renamed, so that concurrent compilations never see
+  // a partial entry
+  char tmp[ENTRY_PATH_MAX + 32];
+  snprintf(tmp, sizeof(tmp), "%s.%d", entry, (int)getpid());
+  FILE *f = fopen(tmp, "wb");
+  bool written = f != NULL;
+  if (written) {
+    written = fwrite(&h, sizeof(h), 1, f) == 1 &&
+              fwrite(b.toks, sizeof(cached_token_t), b.count, f) == b.count &&
+              fwrite(b.strings, 1, b.strings_size, f) == b.strings_size;
+    written = fclose(f) == 0 && written;
+  }
+  if (!written || rename(tmp, entry) != 0) {
+    ul_logger_warn("Could not write an entry of the token cache");
+    remove(tmp);
+  }
+  free(b.toks);
+  free(b.strings);
+}
@@ -1,31 +1,70 @@
 #include "../include/ul_allocator.h"
 #include "../include/ul_assert.h"
+#include "../include/ul_compiler_globals.h"
 #include <stdlib.h>
 
-#define MAX_ARENAS_NUM 1024
+#define MAX_ARENAS_NUM (1024 * 64)
 
 arena_t __internal_arenas[MAX_ARENAS_NUM] = {0};
 bool __internal_arenas_popul[MAX_ARENAS_NUM] = {0};
 int __internal_current_arena = -1;
+allocator_stats_t allocator_stats = {0};
+
+static bool tags_enabled = false;
+static arena_tag_stats_t tags[MAX_ARENA_TAGS];
+static int tags_count = 0;
+
+// the last tag gathers the arenas of every function past MAX_ARENA_TAGS
+static int find_tag(const char *tag) {
+  for (int i = 0; i < tags_count; i++) {
+    if (tags[i].tag == tag || streq(tags[i].tag, tag))
+      return i;
+  }
+  if (tags_count == MAX_ARENA_TAGS - 1)
+    tag = "(others)";
+  if (tags_count == MAX_ARENA_TAGS)
+    return MAX_ARENA_TAGS - 1;
+  tags[tags_count].tag = tag;
+  return tags_count++;
+}
+
+// no arena below this id is free
+static int first_free_id = 0;
 
 int get_first_empty_id(void) {
-  for (int i = 0; i < MAX_ARENAS_NUM; i++) {
-    if (!__internal_arenas_popul[i])
+  for (int i = first_free_id; i < MAX_ARENAS_NUM; i++) {
+    if (!__internal_arenas_popul[i]) {
+      first_free_id = i;
       return i;
+    }
   }
   return -1;
 }
 
-unsigned int new_arena(size_t size) {
+unsigned int new_tagged_arena(size_t size, const char *tag) {
   int res = get_first_empty_id();
   ul_assert(res >= 0,
             "new_arena: Could not create arena... Max arena number exceeded");
 
   void *contents = malloc(size);
   ul_assert(contents != NULL, "new_arena: Could not allocate contents");
-  arena_t tmp = {.size = size, .fill = 0, .contents = contents};
+  arena_t tmp = {.size = size, .fill = 0, .contents = contents, .tag = -1};
+  if (tags_enabled) {
+    tmp.tag = find_tag(tag);
+    arena_tag_stats_t *t = &tags[tmp.tag];
+    t->created++;
+    t->live++;
+    t->live_bytes += size;
+    t->requested += size;
+    if (t->live_bytes > t->peak_bytes)
+      t->peak_bytes = t->live_bytes;
+  }
   __internal_arenas[res] = tmp;
   __internal_arenas_popul[res] = true;
+  allocator_stats.arenas_created++;
+  allocator_stats.live_bytes += size;
+  if (allocator_stats.live_bytes > allocator_stats.peak_bytes)
+    allocator_stats.peak_bytes = allocator_stats.live_bytes;
   return res;
 }
 
@@ -34,8 +73,15 @@ void destroy_arena(unsigned int id) {
   ul_assert(__internal_arenas_popul[id],
             "destroy_arena: Cannot destroy arena: No arena found");
   free(__internal_arenas[id].contents);
+  allocator_stats.live_bytes -= __internal_arenas[id].size;
+  if (__internal_arenas[id].tag >= 0) {
+    tags[__internal_arenas[id].tag].live--;
+    tags[__internal_arenas[id].tag].live_bytes -= __internal_arenas[id].size;
+  }
   __internal_arenas[id] = (arena_t){0};
   __internal_arenas_popul[id] = false;
+  if ((int)id < first_free_id)
+    first_free_id = id;
 }
 
 void set_arena(unsigned int id) {
@@ -52,6 +98,34 @@ void clear_allocator(void) {
   }
 }
 
+allocator_stats_t get_allocator_stats(void) { return allocator_stats; }
+
+void reset_allocator_peak(void) {
+  allocator_stats.peak_bytes = allocator_stats.live_bytes;
+}
+
+void enable_alloc_stats(void) { tags_enabled = true; }
+
+void print_alloc_stats(void) {
+  if (!tags_enabled)
+    return;
+  fprintf(stderr, "%-32s %8s %8s %14s %11s %7s %11s\n", "Arenas by creator",
+          "created", "live", "requested KiB", "used KiB", "wasted", "peak KiB");
+  size_t live = 0;
+  size_t live_bytes = 0;
+  for (int i = 0; i < tags_count; i++) {
+    arena_tag_stats_t t = tags[i];
+    fprintf(stderr, "  %-30.30s %8zu %8zu %14zu %11zu %6.1f%% %11zu\n",
+            t.tag, t.created, t.live, t.requested / 1024, t.used / 1024,
+            t.requested == 0 ? 0 : 100.0 * (t.requested - t.used) / t.requested,
+            t.peak_bytes / 1024);
+    live += t.live;
+    live_bytes += t.live_bytes;
+  }
+  fprintf(stderr, "Still alive at exit: %zu arenas, %zu KiB\n", live,
+          live_bytes / 1024);
+}
+
 void *__internal_alloc(size_t s) {
   ul_assert(__internal_current_arena >= 0,
             "Could not allocate: No arena found");
@@ -68,6 +142,8 @@ void *__internal_alloc(size_t s) {
   void *res = (char *)__internal_arenas[__internal_current_arena].contents +
               __internal_arenas[__internal_current_arena].fill;
   __internal_arenas[__internal_current_arena].fill += s;
+  if (__internal_arenas[__internal_current_arena].tag >= 0)
+    tags[__internal_arenas[__internal_current_arena].tag].used += s;
   return res;
 }
 
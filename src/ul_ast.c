@@ -6,10 +6,19 @@
 
 extern unsigned int parser_arena;
 
+static size_t nodes_count = 0;
+
+static ast_t alloc_node(void) {
+  nodes_count++;
+  return alloc_zero(sizeof(struct ast_struct_t), 1);
+}
+
+size_t ast_nodes_count(void) { return nodes_count; }
+
 ast_t new_strlit(location_t loc, char *content) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_str_lit_t *strlit = alloc(sizeof(ast_str_lit_t), 1);
   set_arena(old_arena);
   strlit->content = content;
@@ -22,7 +31,7 @@ ast_t new_strlit(location_t loc, char *content) {
 ast_t new_charlit(location_t loc, char *content) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_char_lit_t *charlit = alloc(sizeof(ast_char_lit_t), 1);
   set_arena(old_arena);
   charlit->content = content;
@@ -35,7 +44,7 @@ ast_t new_charlit(location_t loc, char *content) {
 ast_t new_numlit(location_t loc, char *content, bool has_point) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_num_lit_t *nlit = alloc(sizeof(ast_num_lit_t), 1);
   set_arena(old_arena);
   nlit->content = content;
@@ -49,12 +58,13 @@ ast_t new_numlit(location_t loc, char *content, bool has_point) {
 ast_t new_binop(location_t loc, token_kind_t op, ast_t left, ast_t right) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_binop_t *binop = alloc(sizeof(ast_binop_t), 1);
   set_arena(old_arena);
   binop->op = op;
   binop->left = left;
   binop->right = right;
+  binop->first = left->kind == A_BINOP ? left->as.binop->first : left;
   res->kind = A_BINOP;
   res->as.binop = binop;
   res->loc = loc;
@@ -65,7 +75,7 @@ ast_t new_unary(location_t loc, token_kind_t op, ast_t operand,
                 bool is_postfix) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_unary_t *u = alloc(sizeof(ast_unary_t), 1);
   set_arena(old_arena);
   u->is_postfix = is_postfix;
@@ -80,7 +90,7 @@ ast_t new_unary(location_t loc, token_kind_t op, ast_t operand,
 ast_t new_iden(location_t loc, char *content) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_iden_t *iden = alloc(sizeof(ast_iden_t), 1);
   set_arena(old_arena);
   iden->content = content;
@@ -93,11 +103,12 @@ ast_t new_iden(location_t loc, char *content) {
 ast_t new_prog(location_t loc) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_prog_t *prog = alloc(sizeof(ast_prog_t), 1);
   set_arena(old_arena);
   ast_array_t arr = new_ast_dyn();
-  *prog = (ast_prog_t){arr};
+  ast_array_t map_types = new_ast_dyn();
+  *prog = (ast_prog_t){arr, map_types};
   *res = (struct ast_struct_t){A_PROG, {.prog = prog}, .loc = {0}};
   res->loc = loc;
   return res;
@@ -106,7 +117,7 @@ ast_t new_prog(location_t loc) {
 ast_t new_fundef_param(location_t loc, ast_t type, char *name) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_fundef_param_t *param = alloc(sizeof(ast_fundef_param_t), 1);
   set_arena(old_arena);
   param->name = name;
@@ -121,13 +132,15 @@ ast_t new_fundef(location_t loc, ast_array_t params, ast_t return_type,
                  char *name, ast_array_t body) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_fundef_t *fundef = alloc(sizeof(ast_fundef_t), 1);
   set_arena(old_arena);
   fundef->params = params;
   fundef->return_type = return_type;
   fundef->name = name;
   fundef->body = body;
+  fundef->is_comptime = false;
+  fundef->is_inline = false;
   res->kind = A_FUNDEF;
   res->as.fundef = fundef;
   res->loc = loc;
@@ -137,7 +150,7 @@ ast_t new_fundef(location_t loc, ast_array_t params, ast_t return_type,
 ast_t new_funcall(location_t loc, char *name, ast_array_t args) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_funcall_t *funcall = alloc(sizeof(ast_funcall_t), 1);
   set_arena(old_arena);
   funcall->name = name;
@@ -151,7 +164,7 @@ ast_t new_funcall(location_t loc, char *name, ast_array_t args) {
 ast_t new_compound(location_t loc, ast_array_t stmts) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_compound_t *compound = alloc(sizeof(ast_compound_t), 1);
   set_arena(old_arena);
   *compound = (ast_compound_t){stmts};
@@ -163,7 +176,7 @@ ast_t new_compound(location_t loc, ast_array_t stmts) {
 ast_t new_index(location_t loc, ast_t value, ast_t index) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_index_t *i = alloc(sizeof(ast_index_t), 1);
   set_arena(old_arena);
   i->index = index;
@@ -177,7 +190,7 @@ ast_t new_index(location_t loc, ast_t value, ast_t index) {
 ast_t new_vardef(location_t loc, char *name, ast_t type, ast_t value) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_vardef_t *vdef = alloc(sizeof(ast_vardef_t), 1);
   set_arena(old_arena);
   vdef->name = name;
@@ -192,7 +205,7 @@ ast_t new_vardef(location_t loc, char *name, ast_t type, ast_t value) {
 ast_t new_if(location_t loc, ast_t condition, ast_t ifstmt, ast_t elsestmt) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_if_t *ifnode = alloc(sizeof(ast_if_t), 1);
   set_arena(old_arena);
   ifnode->condition = condition;
@@ -207,7 +220,7 @@ ast_t new_if(location_t loc, ast_t condition, ast_t ifstmt, ast_t elsestmt) {
 ast_t new_return(location_t loc, ast_t expr) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_return_t *ret = alloc(sizeof(ast_return_t), 1);
   set_arena(old_arena);
   ret->expr = expr;
@@ -221,7 +234,7 @@ ast_t new_loop(location_t loc, char *varname, ast_t init, ast_t end, ast_t stmt,
                bool strict) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_loop_t *loop = alloc(sizeof(ast_loop_t), 1);
   set_arena(old_arena);
   loop->end = end;
@@ -238,7 +251,7 @@ ast_t new_loop(location_t loc, char *varname, ast_t init, ast_t end, ast_t stmt,
 ast_t new_access(location_t loc, ast_t object, ast_t field) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_access_t *access = alloc(sizeof(ast_access_t), 1);
   set_arena(old_arena);
   access->object = object;
@@ -252,7 +265,7 @@ ast_t new_access(location_t loc, ast_t object, ast_t field) {
 ast_t new_tdef(location_t loc, type_t type) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_tdef_t *tdef = alloc(sizeof(ast_tdef_t), 1);
   set_arena(old_arena);
   tdef->type = type;
@@ -265,7 +278,7 @@ ast_t new_tdef(location_t loc, type_t type) {
 ast_t new_assignement(location_t loc, ast_t expr, ast_t value) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_assign_t *assign = alloc(sizeof(ast_assign_t), 1);
   set_arena(old_arena);
   assign->expr = expr;
@@ -279,7 +292,7 @@ ast_t new_assignement(location_t loc, ast_t expr, ast_t value) {
 ast_t new_while(location_t loc, ast_t cond, ast_t stmt) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_while_t *w = alloc(sizeof(ast_while_t), 1);
   w->condition = cond;
   w->stmt = stmt;
@@ -290,14 +303,17 @@ ast_t new_while(location_t loc, ast_t cond, ast_t stmt) {
   return res;
 }
 
-ast_t new_type(location_t loc, char *name, int list_n) {
+ast_t new_type(location_t loc, char *name, int list_n, bool is_slice) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_type_t *t = alloc(sizeof(ast_type_t), 1);
   set_arena(old_arena);
   t->name = name;
   t->list_n = list_n;
+  t->is_slice = is_slice;
+  t->key = NULL;
+  t->value = NULL;
   res->kind = A_TYPE;
   res->as.type = t;
   res->loc = loc;
@@ -307,7 +323,7 @@ ast_t new_type(location_t loc, char *name, int list_n) {
 ast_t new_iter(location_t loc, ast_t var, ast_t itered, ast_t stmt) {
   unsigned int old_arena = get_arena();
   set_arena(parser_arena);
-  ast_t res = alloc(sizeof(struct ast_struct_t), 1);
+  ast_t res = alloc_node();
   ast_iter_t *iter = alloc(sizeof(ast_iter_t), 1);
   set_arena(old_arena);
   iter->var = var;
@@ -29,10 +29,7 @@ void ul_dyn_append(__internal_dyn_array_t *arr, ...) {
   va_list ptr;
   va_start(ptr, arr);
 
-  unsigned int old_arena = get_arena();
-  unsigned int a = new_arena(arr->stride);
-  set_arena(a);
-  char *buff = alloc_zero(arr->stride, 1);
+  char buff[MAX_ITEM_SIZE];
 
   if (!arr->is_ptr) {
     if (arr->stride == 16) {
@@ -45,21 +42,18 @@ void ul_dyn_append(__internal_dyn_array_t *arr, ...) {
       buff[i] = t.contents[i];
     }
     va_end(ptr);
-
-    if (arr->length * arr->stride >= arr->capacity) {
-      __internal_resize_dyn_array(arr);
-    }
   } else {
     void *tmp = va_arg(ptr, void *);
     memcpy(buff, &tmp, sizeof(void *));
     va_end(ptr);
   }
 
+  if (arr->length * arr->stride >= arr->capacity) {
+    __internal_resize_dyn_array(arr);
+  }
+
   memcpy((char *)arr->contents + arr->length * arr->stride, buff, arr->stride);
   arr->length++;
-
-  destroy_arena(a);
-  set_arena(old_arena);
 }
 
 void __internal_resize_dyn_array(__internal_dyn_array_t *arr) {
@@ -1,62 +1,136 @@
 #include "../include/ul_flow.h"
+#include "../include/build_cache.h"
+#include "../include/cache.h"
 #include "../include/generator.h"
+#include "../include/incremental.h"
 #include "../include/lexer.h"
 #include "../include/logger.h"
 #include "../include/parser.h"
+#include "../include/str_set.h"
+#include "../include/time_report.h"
+#include "../include/token_cache.h"
 #include "../include/ul_allocator.h"
 #include "../include/ul_compiler_globals.h"
+#include "../include/watch.h"
 #include <fcntl.h>
 #include <linux/limits.h>
 #include <stdlib.h>
 #include <unistd.h>
 
-str_array_t included_files;
+str_set_t included_files;
 
 unsigned int inc_arena;
 
-void ul_start(int argc, char **argv) {
-
-  logger_severity_t severity = SEV_WARN;
+void ul_parse_options(int argc, char **argv, ul_options_t *res) {
+  *res = (ul_options_t){.severity = SEV_WARN,
+                        .regions = true,
+                        .bounds_checked = true,
+                        .caches = true,
+                        .opt_level = "-O2",
+                        .sources_fd = -1};
   bool sev_set = false;
-
-  char *output;
   bool output_set = false;
-
-  char *input;
   bool input_set = false;
 
-  create_logger(&ul_global_logger);
-
   for (int i = 1; i < argc; i++) {
     char *buff = argv[i];
     if (*buff != '-' && !input_set) {
-      input = buff;
+      res->input = buff;
       input_set = true;
     } else if ((streq(buff, "-s") || streq(buff, "--silent")) && !sev_set) {
-      severity = SEV_SILENT;
+      res->severity = SEV_SILENT;
       sev_set = true;
     } else if ((streq(buff, "-v") || streq(buff, "--verbose")) && !sev_set) {
-      severity = SEV_INFO;
+      res->severity = SEV_INFO;
       sev_set = true;
     } else if (streq(buff, "--ignore-warnings") && !sev_set) {
-      severity = SEV_ERRO;
+      res->severity = SEV_ERRO;
       sev_set = true;
+    } else if (streq(buff, "--no-regions")) {
+      res->regions = false;
+    } else if (streq(buff, "--no-cache")) {
+      res->caches = false;
+    } else if (streq(buff, "--incremental")) {
+      res->incremental = true;
+    } else if (streq(buff, "--alloc-stats")) {
+      res->alloc_stats = true;
+    } else if (streq(buff, "--time-report") ||
+               streq(buff, "--time-report=json")) {
+      res->time_report = true;
+      res->time_report_json = streq(buff, "--time-report=json");
+    } else if (streq(buff, "--watch")) {
+      res->watch = true;
+    } else if ((streq(buff, "--daemon") || streq(buff, "--connect")) &&
+               i + 1 < argc) {
+      if (streq(buff, "--daemon"))
+        res->daemon = argv[++i];
+      else
+        res->connect = argv[++i];
+    } else if (streq(buff, "--bounds=checked")) {
+      res->bounds_checked = true;
+    } else if (streq(buff, "--bounds=unchecked")) {
+      res->bounds_checked = false;
+    } else if (strncmp(buff, "--bounds=", 9) == 0) {
+      ul_logger_erro("--bounds expects 'checked' or 'unchecked'");
+      ul_exit(1);
+    } else if (streq(buff, "-O0") || streq(buff, "-O1") || streq(buff, "-O2") ||
+               streq(buff, "-O3") || streq(buff, "-Os")) {
+      res->opt_level = buff;
+    } else if (strncmp(buff, "-O", 2) == 0) {
+      ul_logger_erro("-O expects 0, 1, 2, 3 or s");
+      ul_exit(1);
     } else if ((streq(buff, "-o") || streq(buff, "--output")) && !output_set) {
       buff = argv[++i];
-      output = buff;
+      res->output = buff;
       output_set = true;
     }
   }
+}
 
-  set_logger_severity(&ul_global_logger, severity);
+unsigned char ul_start(int argc, char **argv) {
+  create_logger(&ul_global_logger);
+  ul_options_t options;
+  ul_parse_options(argc, argv, &options);
+  set_logger_severity(&ul_global_logger, options.severity);
 
-  if (!input_set) {
+  if (options.connect != NULL)
+    ul_exit(send_request(options.connect, argc, argv));
+  if (options.daemon != NULL) {
+    serve_requests(options.daemon);
+    return 0;
+  }
+  if (!options.watch)
+    return ul_compile(options);
+  if (options.input == NULL) {
+    ul_logger_erro("You must specify an input file");
+    ul_exit(1);
+  }
+  watch_program(options);
+  return 0;
+}
+
+unsigned char ul_compile(ul_options_t options) {
+  char *input = options.input;
+  char *output = options.output;
+  char *opt_level = options.opt_level;
+  bool regions = options.regions;
+  bool bounds_checked = options.bounds_checked;
+  bool caches = options.caches;
+  bool incremental = options.incremental;
+
+  set_logger_severity(&ul_global_logger, options.severity);
+  if (options.time_report)
+    enable_time_report(options.time_report_json);
+  if (options.alloc_stats)
+    enable_alloc_stats();
+
+  if (input == NULL) {
     ul_logger_erro("You must specify an input file");
     ul_exit(1);
   }
 
   char default_out[] = "a.out";
-  if (!output_set) {
+  if (output == NULL) {
     output = default_out;
   }
 
@@ -64,57 +138,117 @@ void ul_start(int argc, char **argv) {
   unsigned int arena = new_arena(32);
   set_arena(arena);
 
-  included_files = new_str_dyn();
+  included_files = new_str_set();
   inc_arena = new_arena(1024 * PATH_MAX);
 
+  if (caches && !open_cache_dir()) {
+    ul_logger_warn("Could not create the cache directory, caches are disabled");
+    caches = false;
+  }
+  if (caches)
+    enable_token_cache();
+
   ul_logger_info("Starting Lexer");
-  lexer_t l;
-  new_lexer(&l, input);
-  lex_program(&l);
+  begin_phase(PHASE_LEXER);
+  token_array_t toks = new_tok_dyn();
+  lex_file(&toks, input);
+  end_phase(PHASE_LEXER);
+  set_report_count(COUNT_TOKENS, ul_dyn_length(toks));
+  if (options.sources_fd >= 0)
+    send_sources(options.sources_fd, input, included_files);
+
+  char out[128] = {0};
+  strcpy(out, output);
+  strcat(out, ".c");
+
+  // the parts of an incremental build already only rebuild what changed
+  unsigned long long build_key = 0;
+  if (caches && !incremental) {
+    char flags[64];
+    sprintf(flags, "%s %d %d %d", opt_level, regions, bounds_checked,
+            options.alloc_stats);
+    build_key = build_cache_key(input, included_files, flags);
+    if (build_cache_fetch(build_key, output, out)) {
+      ul_logger_info("Build found in the cache");
+      return 0;
+    }
+  }
 
   ul_logger_info("Starting Parser");
-  parser_t p = new_parser(l.toks);
+  begin_phase(PHASE_PARSER);
+  parser_t p = new_parser(toks);
   ast_t prog = parse_program(&p);
+  end_phase(PHASE_PARSER);
+  set_report_count(COUNT_AST_NODES, ast_nodes_count());
   ul_logger_info("File successfully parsed");
 
   ul_logger_info("Starting Generator");
-  char out[128] = {0};
-  strcpy(out, output);
-  strcat(out, ".c");
-  set_generator_target(out);
+  begin_phase(PHASE_GENERATOR);
+  char parts[PATH_MAX];
+  snprintf(parts, sizeof(parts), "%s.parts", output);
+  if (incremental)
+    set_generator_incremental(parts);
+  else
+    set_generator_target(out);
+  set_generator_regions(regions);
+  set_generator_bounds_checked(bounds_checked);
+  set_generator_alloc_stats(options.alloc_stats);
   generate_program(prog);
-  if (!has_failed()) {
+  end_phase(PHASE_GENERATOR);
+  set_report_count(COUNT_TYPES, ul_dyn_length(generator.context.types));
+  set_report_count(COUNT_VARS, ul_dyn_length(generator.context.vars));
+  if (has_failed()) {
+    ul_logger_erro("Program failed to compile...");
+    return 1;
+  }
 
-    ul_logger_info("File successfully generated");
-    destroy_generator();
+  ul_logger_info("File successfully generated");
+  destroy_generator();
 
-    char command[256];
-    char info[270] = {0};
+  begin_phase(PHASE_BACKEND);
+  if (incremental) {
+    ul_logger_info("Building the parts of the program with make");
+    bool built = build_parts(output, opt_level);
+    end_phase(PHASE_BACKEND);
+    if (!built) {
+      ul_logger_erro("Could not build the parts of the program");
+      return 1;
+    }
+    return 0;
+  }
 
-    ul_logger_info("Formatting transpiled C code");
-    sprintf(command, "clang-format -i %s", out);
-    system(command);
-    sprintf(info, "[CMD] %s", command);
-    ul_logger_info(info);
+  char command[256];
+  char info[270] = {0};
 
-    sprintf(command, "sed -i \'/^$/d\' %s", out);
-    system(command);
-    sprintf(info, "[CMD] %s", command);
-    ul_logger_info(info);
+  ul_logger_info("Formatting transpiled C code");
+  sprintf(command, "clang-format -i %s", out);
+  system(command);
+  sprintf(info, "[CMD] %s", command);
+  ul_logger_info(info);
 
-    ul_logger_info("Compiling transpiled C code with gcc");
+  sprintf(command, "sed -i \'/^$/d\' %s", out);
+  system(command);
+  sprintf(info, "[CMD] %s", command);
+  ul_logger_info(info);
 
-    sprintf(command, "/usr/bin/gcc -o %s %s", output, out);
-    system(command);
-    sprintf(info, "[CMD] %s", command);
-    ul_logger_info(info);
-  } else {
-    ul_logger_erro("Program failed to compile...");
+  ul_logger_info("Compiling transpiled C code with gcc");
+
+  sprintf(command, "/usr/bin/gcc %s -o %s %s", opt_level, output, out);
+  int status = system(command);
+  sprintf(info, "[CMD] %s", command);
+  ul_logger_info(info);
+  end_phase(PHASE_BACKEND);
+  if (status != 0) {
+    ul_logger_erro("Could not compile the transpiled C code with gcc");
+    return 1;
   }
+  if (caches)
+    build_cache_store(build_key, output, out);
 
   // destroy_lexer(l);
   // destroy_parser(p);
   // destroy_arena(arena);
+  return 0;
 }
 
 void ul_exit(unsigned char exit_code) {
@@ -124,7 +258,9 @@ void ul_exit(unsigned char exit_code) {
   exit(exit_code);
 }
 
-void ul_end(void) {
+void ul_end(unsigned char exit_code) {
+  print_time_report();
+  print_alloc_stats();
   ul_logger_info("Ended Unilang compiler");
-  ul_exit(0);
+  ul_exit(exit_code);
 }
\ No newline at end of file
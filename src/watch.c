@@ -0,0 +1,294 @@
+// WATCH SOURCE FILE
+// Paul Passeron
+
+// Watch mode and compilation daemon.
+// The compiler keeps global state for a whole compilation (arenas, included
+// files, analyses), so each compilation runs in a child forked from a
+// process that already went through the startup: the children start warm,
+// the tokens of the sources being mapped from the token cache, and never
+// leak state into the next compilation.
+// A request to the daemon is the working directory of the client, then the
+// arguments of the compiler, each followed by a NUL byte: the compilation
+// runs in that directory, as if the client ran the compiler itself. The
+// daemon answers with the output of the compilation followed by a byte
+// holding its exit status.
+
+#include "../include/watch.h"
+#include "../include/logger.h"
+#include "../include/ul_allocator.h"
+#include "../include/ul_assert.h"
+#include "../include/ul_compiler_globals.h"
+#include <errno.h>
+#include <libgen.h>
+#include <linux/limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+void send_sources(int fd, const char *input, str_set_t sources) {
+  FILE *f = fdopen(fd, "w");
+  if (f == NULL) {
+    close(fd);
+    return;
+  }
+  char path[PATH_MAX] = {0};
+  if (realpath(input, path) != NULL)
+    fprintf(f, "%s\n", path);
+  for (size_t i = 0; i < sources.capacity; i++) {
+    if (sources.slots[i] != NULL)
+      fprintf(f, "%s\n", sources.slots[i]);
+  }
+  fclose(f);
+}
+
+// runs the compilation in a child, that sends its sources to sources_fd
+static void start_compilation(ul_options_t options, int sources_fd) {
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid < 0) {
+    ul_logger_erro("Could not start the compilation");
+    ul_exit(1);
+  }
+  if (pid == 0) {
+    options.sources_fd = sources_fd;
+    ul_end(ul_compile(options));
+  }
+  close(sources_fd);
+}
+
+static unsigned char wait_child(void) {
+  int status;
+  while (wait(&status) < 0) {
+    if (errno != EINTR)
+      return 1;
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+// reads everything from fd into a buffer, that the caller frees
+static char *read_all(int fd) {
+  size_t capacity = 4096;
+  size_t length = 0;
+  char *res = malloc(capacity);
+  ul_assert(res != NULL, "Could not allocate the sources of the program");
+  while (true) {
+    if (length + 1 >= capacity) {
+      capacity *= 2;
+      res = realloc(res, capacity);
+      ul_assert(res != NULL, "Could not allocate the sources of the program");
+    }
+    ssize_t n = read(fd, res + length, capacity - length - 1);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    length += n;
+  }
+  res[length] = 0;
+  return res;
+}
+
+// Directories are watched rather than files, as editors often replace a
+// file instead of writing to it
+static char *watched_dirs[WATCH_MAX_DIRS];
+
+static void watch_sources(int inotify, char *paths, str_set_t *sources) {
+  for (char *path = strtok(paths, "\n"); path != NULL;
+       path = strtok(NULL, "\n")) {
+    str_set_insert(sources, path);
+    char dir[PATH_MAX];
+    strcpy(dir, path);
+    int wd = inotify_add_watch(inotify, dirname(dir),
+                               IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd >= 0 && wd < WATCH_MAX_DIRS && watched_dirs[wd] == NULL)
+      watched_dirs[wd] = strdup(dir);
+  }
+}
+
+// returns whether the events read from inotify change one of the sources
+static bool read_changes(int inotify, str_set_t sources) {
+  char buff[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t length = read(inotify, buff, sizeof(buff));
+  bool res = false;
+  for (ssize_t i = 0; i < length;) {
+    struct inotify_event *e = (struct inotify_event *)(buff + i);
+    i += sizeof(struct inotify_event) + e->len;
+    if (e->len == 0 || e->wd < 0 || e->wd >= WATCH_MAX_DIRS ||
+        watched_dirs[e->wd] == NULL)
+      continue;
+    char path[PATH_MAX + NAME_MAX + 2];
+    snprintf(path, sizeof(path), "%s/%s", watched_dirs[e->wd], e->name);
+    res = res || str_set_contains(sources, path);
+  }
+  return res;
+}
+
+static void wait_for_change(int inotify, str_set_t sources) {
+  while (!read_changes(inotify, sources))
+    ;
+  // an editor may write a file in several steps
+  struct pollfd p = {.fd = inotify, .events = POLLIN};
+  while (poll(&p, 1, WATCH_DEBOUNCE_MS) > 0)
+    read_changes(inotify, sources);
+}
+
+void watch_program(ul_options_t options) {
+  static char input_path[PATH_MAX];
+  set_arena(new_arena(32));
+  int inotify = inotify_init1(IN_CLOEXEC);
+  if (inotify < 0) {
+    ul_logger_erro("Could not watch the sources of the program");
+    ul_exit(1);
+  }
+  while (true) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+      ul_logger_erro("Could not watch the sources of the program");
+      ul_exit(1);
+    }
+    start_compilation(options, fds[1]);
+    char *paths = read_all(fds[0]);
+    close(fds[0]);
+    unsigned char status = wait_child();
+    str_set_t sources = new_str_set();
+    watch_sources(inotify, paths, &sources);
+    // the compilation failed before its sources were known
+    if (sources.count == 0 && realpath(options.input, input_path) != NULL)
+      watch_sources(inotify, input_path, &sources);
+    // shown whatever the severity of the logger, as it is what users wait for
+    printf("Compilation %s, watching %zu files for changes\n",
+           status == 0 ? "done" : "failed", sources.count);
+    fflush(stdout);
+    wait_for_change(inotify, sources);
+    destroy_str_set(sources);
+    free(paths);
+  }
+}
+
+// answers a request with the output of the compilation and its exit status
+static void serve_request(int conn) {
+  char *request = read_all(conn);
+  char *cwd = request;
+  if (*cwd == 0) {
+    unsigned char status = 1;
+    write(conn, &status, 1);
+    close(conn);
+    free(request);
+    return;
+  }
+  char *argv[REQUEST_MAX_ARGS + 1] = {"Unilang"};
+  int argc = 1;
+  for (char *arg = cwd + strlen(cwd) + 1; *arg != 0 && argc < REQUEST_MAX_ARGS;
+       arg += strlen(arg) + 1)
+    argv[argc++] = arg;
+  argv[argc] = NULL;
+
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(conn, STDOUT_FILENO);
+    dup2(conn, STDERR_FILENO);
+    close(conn);
+    if (chdir(cwd) != 0) {
+      ul_logger_erro("Could not enter the working directory of the client");
+      ul_exit(1);
+    }
+    ul_options_t options;
+    ul_parse_options(argc, argv, &options);
+    ul_end(ul_compile(options));
+  }
+  unsigned char status = pid < 0 ? 1 : wait_child();
+  write(conn, &status, 1);
+  close(conn);
+  free(request);
+}
+
+void serve_requests(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  int server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (server < 0 || strlen(path) >= sizeof(addr.sun_path)) {
+    ul_logger_erro("Could not create the socket of the daemon");
+    ul_exit(1);
+  }
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  if (bind(server, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(server, 64) != 0) {
+    ul_logger_erro("Could not listen on the socket of the daemon");
+    ul_exit(1);
+  }
+  // requests are served concurrently, by children that nobody waits for
+  signal(SIGCHLD, SIG_IGN);
+  char info[PATH_MAX + 32];
+  snprintf(info, sizeof(info), "Listening on %s", path);
+  ul_logger_info(info);
+  while (true) {
+    int conn = accept(server, NULL, NULL);
+    if (conn < 0)
+      continue;
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(server);
+      signal(SIGCHLD, SIG_DFL);
+      serve_request(conn);
+      _exit(0);
+    }
+    close(conn);
+  }
+}
+
+unsigned char send_request(const char *path, int argc, char **argv) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  int conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (conn < 0 || strlen(path) >= sizeof(addr.sun_path)) {
+    ul_logger_erro("Could not create a socket");
+    return 1;
+  }
+  strcpy(addr.sun_path, path);
+  if (connect(conn, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    ul_logger_erro("Could not connect to the daemon");
+    return 1;
+  }
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd)) == NULL) {
+    ul_logger_erro("Could not get the working directory");
+    close(conn);
+    return 1;
+  }
+  FILE *f = fdopen(conn, "r+");
+  fwrite(cwd, 1, strlen(cwd) + 1, f);
+  for (int i = 1; i < argc; i++) {
+    if (streq(argv[i], "--connect")) {
+      i++;
+      continue;
+    }
+    fwrite(argv[i], 1, strlen(argv[i]) + 1, f);
+  }
+  fflush(f);
+  shutdown(conn, SHUT_WR);
+  // the last byte is the exit status, not output
+  int status = -1;
+  int c;
+  while ((c = fgetc(f)) != EOF) {
+    if (status >= 0)
+      putchar(status);
+    status = c;
+  }
+  fclose(f);
+  fflush(stdout);
+  if (status < 0) {
+    ul_logger_erro("The daemon closed the connection");
+    return 1;
+  }
+  return status;
+}